@@ -1,6 +1,12 @@
 #include "CImg.h"
 #include <cmath>
 #include <algorithm>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
 
 using namespace cimg_library;
 static const double EPS = 1e-5;
@@ -12,126 +18,585 @@ typedef struct Point {
     Point() : x(0), y(0) {}
 } point;
 
-// 用于将图片缩放size倍
-CImg<unsigned char> myresize(CImg<unsigned char>& img, double size) {
+// 将插值结果写入像素，整数类型需四舍五入并截断到取值范围内
+inline void storePixel(float &d, double v) { d = (float)v; }
+inline void storePixel(double &d, double v) { d = v; }
+inline void storePixel(unsigned char &d, double v) {
+    d = (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v + 0.5));
+}
+inline void storePixel(unsigned short &d, double v) {
+    d = (unsigned short)(v < 0 ? 0 : (v > 65535 ? 65535 : v + 0.5));
+}
+
+// 通道数，C不为0时在编译期确定，通道循环可以完全展开；C为0时使用img的实际通道数
+template <int C, typename T>
+inline int numChannels(CImg<T> const &img) {
+    return C ? C : img.spectrum();
+}
+
+// 返回下标i截断到[0, n - 1]后的结果
+inline int clampIndex(int i, int n) {
+    return i < 0 ? 0 : (i >= n ? n - 1 : i);
+}
+
+// 将坐标o截断到[0, n - 1]内，返回左侧整点及右侧整点，frac为小数部分
+inline void clampSample(double o, int n, unsigned int &i0, unsigned int &i1, double &frac) {
+    if (o < 0) o = 0;
+    if (o > n - 1) o = n - 1;
+    i0 = (unsigned int)o;
+    i1 = (i0 + 1 >= (unsigned int)n ? i0 : i0 + 1);
+    frac = o - i0;
+}
+
+// 以下为插值核，作为模板参数传给映射函数，在编译期确定所用的插值方法
+// 每个核提供sample<C>(src, ox, oy, dst, x, y)，对src中(ox, oy)处的所有通道插值并写入dst(x, y)，
+// C为编译期确定的通道数，为0时按dst的实际通道数处理
+// 核读取的邻点为floor(o) - before到floor(o) + after，before <= o < n - after时邻点都在图内，
+// 此时可以调用不截断坐标的sampleInside<C>
+
+// 最近邻插值
+struct NearestKernel {
+    enum { before = 0, after = 1 };
+    template <int C, typename T, typename D>
+    static void sample(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        int ix = clampIndex((int)std::floor(ox + 0.5), src.width()),
+            iy = clampIndex((int)std::floor(oy + 0.5), src.height());
+        for (int v = 0; v < numChannels<C>(dst); v++) storePixel(dst(x, y, v), src(ix, iy, v));
+    }
+    template <int C, typename T, typename D>
+    static void sampleInside(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        int ix = (int)(ox + 0.5), iy = (int)(oy + 0.5);
+        for (int v = 0; v < numChannels<C>(dst); v++) storePixel(dst(x, y, v), src(ix, iy, v));
+    }
+};
+
+// 双线性插值
+struct BilinearKernel {
+    enum { before = 0, after = 1 };
+    template <int C, typename T, typename D>
+    static void sample(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        unsigned int ix0, iy0, ix1, iy1;
+        double px, py;
+        clampSample(ox, src.width(),  ix0, ix1, px);
+        clampSample(oy, src.height(), iy0, iy1, py);
+        blend<C>(src, ix0, iy0, ix1 - ix0, (unsigned long)(iy1 - iy0) * src.width(), px, py, dst, x, y);
+    }
+    // 四个邻点都在图内，右侧和下方的邻点总是相邻的像素
+    template <int C, typename T, typename D>
+    static void sampleInside(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        unsigned int ix0 = (unsigned int)ox, iy0 = (unsigned int)oy;
+        blend<C>(src, ix0, iy0, 1, src.width(), ox - ix0, oy - iy0, dst, x, y);
+    }
+    // 四个邻点相对(ix0, iy0)的偏移在各通道中相同，只算一次
+    template <int C, typename T, typename D>
+    static void blend(CImg<T> const &src, unsigned int ix0, unsigned int iy0, unsigned long dx, unsigned long dy,
+                      double px, double py, CImg<D> &dst, int x, int y) {
+        const T *p = src.data(ix0, iy0);
+        unsigned long dc = (unsigned long)src.width() * src.height();
+        double w00 = (1 - px) * (1 - py), w01 = (1 - px) * py, w10 = px * (1 - py), w11 = px * py;
+        for (int v = 0; v < numChannels<C>(dst); v++, p += dc)
+            storePixel(dst(x, y, v), p[0] * w00 + p[dy] * w01 + p[dx] * w10 + p[dx + dy] * w11);
+    }
+};
+
+// 可分离插值核的权重表，将小数部分量化为PHASES段，每段预先算好2*radius个归一化的权重
+template <class K>
+struct WeightTable {
+    enum { PHASES = 256, TAPS = 2 * K::radius };
+    double w[PHASES + 1][TAPS];
+
+    WeightTable() {
+        for (int p = 0; p <= PHASES; p++) {
+            double t = (double)p / PHASES, sum = 0;
+            for (int i = 0; i < TAPS; i++) sum += (w[p][i] = K::weight(i - (K::radius - 1) - t));
+            for (int i = 0; i < TAPS; i++) w[p][i] /= sum;
+        }
+    }
+
+    static WeightTable const &get() {
+        static WeightTable table;
+        return table;
+    }
+};
+
+// 按权重表做可分离插值，先沿x方向对2*radius行分别加权，再沿y方向加权
+// Clamp为false时调用方保证所有邻点都在图内，不再截断下标
+template <class K, int C, bool Clamp, typename T, typename D>
+void separableSample(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+    enum { R = K::radius, TAPS = 2 * K::radius, PHASES = WeightTable<K>::PHASES };
+    WeightTable<K> const &table = WeightTable<K>::get();
+    int ix = (int)std::floor(ox), iy = (int)std::floor(oy);
+    double const *wx = table.w[(int)((ox - ix) * PHASES + 0.5)],
+                 *wy = table.w[(int)((oy - iy) * PHASES + 0.5)];
+    int xs[TAPS], ys[TAPS];
+    for (int i = 0; i < TAPS; i++) {
+        xs[i] = Clamp ? clampIndex(ix - R + 1 + i, src.width())  : ix - R + 1 + i;
+        ys[i] = Clamp ? clampIndex(iy - R + 1 + i, src.height()) : iy - R + 1 + i;
+    }
+    for (int v = 0; v < numChannels<C>(dst); v++) {
+        double sum = 0;
+        for (int j = 0; j < TAPS; j++) {
+            const T *row = src.data(0, ys[j], 0, v);
+            double rsum = 0;
+            for (int i = 0; i < TAPS; i++) rsum += wx[i] * row[xs[i]];
+            sum += wy[j] * rsum;
+        }
+        storePixel(dst(x, y, v), sum);
+    }
+}
+
+// 双三次插值(Catmull-Rom，a = -0.5)
+struct BicubicKernel {
+    enum { radius = 2, before = radius - 1, after = radius };
+    static double weight(double t) {
+        t = fabs(t);
+        if (t < 1) return (1.5 * t - 2.5) * t * t + 1;
+        if (t < 2) return ((-0.5 * t + 2.5) * t - 4) * t + 2;
+        return 0;
+    }
+    template <int C, typename T, typename D>
+    static void sample(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        separableSample<BicubicKernel, C, true>(src, ox, oy, dst, x, y);
+    }
+    template <int C, typename T, typename D>
+    static void sampleInside(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        separableSample<BicubicKernel, C, false>(src, ox, oy, dst, x, y);
+    }
+};
+
+// Lanczos插值，a = 3
+struct LanczosKernel {
+    enum { radius = 3, before = radius - 1, after = radius };
+    static double weight(double t) {
+        if (fabs(t) < EPS) return 1;
+        if (fabs(t) >= radius) return 0;
+        double pt = cimg::PI * t;
+        return radius * sin(pt) * sin(pt / radius) / (pt * pt);
+    }
+    template <int C, typename T, typename D>
+    static void sample(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        separableSample<LanczosKernel, C, true>(src, ox, oy, dst, x, y);
+    }
+    template <int C, typename T, typename D>
+    static void sampleInside(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        separableSample<LanczosKernel, C, false>(src, ox, oy, dst, x, y);
+    }
+};
+
+
+// 面积平均缩放时一个方向上的权重表
+// 输出下标o对应原图中[start[o], start[o] + taps)内的像素，权重为weight[o * taps + k]
+// 每个权重为输出像素覆盖的区间与原图像素的重叠长度，归一化后和为1，不足taps个时补0
+struct AreaWeights {
+    int taps;
+    std::vector<int> start;
+    std::vector<float> weight;
+
+    AreaWeights(int srcn, int dstn) : start(dstn) {
+        double scale = (double)srcn / dstn;
+        taps = (int)std::ceil(scale) + 1;
+        if (taps > srcn) taps = srcn;
+        weight.assign(dstn * taps, 0);
+        for (int o = 0; o < dstn; o++) {
+            double a = o * scale, b = std::min((o + 1) * scale, (double)srcn);
+            int s = std::min((int)a, srcn - taps);
+            start[o] = s;
+            for (int k = 0; k < taps; k++) {
+                double overlap = std::min(b, s + k + 1.0) - std::max(a, (double)s + k);
+                if (overlap > 0) weight[o * taps + k] = overlap / (b - a);
+            }
+        }
+    }
+};
+
+// 用于将图片缩放size倍，每个输出像素取其覆盖的原图区域的面积平均
+// 权重表在每个方向上只算一次，先逐行做水平方向的加权，再对整行做竖直方向的加权
+template <typename T>
+CImg<T> myresize(CImg<T>& img, double size) {
+    if (size == 1) return img;
+    int nw = img.width() * size, nh = img.height() * size;
+    if (nw <= 0 || nh <= 0) return CImg<T>();
+    AreaWeights wx(img.width(), nw), wy(img.height(), nh);
+    CImg<T> re(nw, nh, 1, img.spectrum(), 0);
+
+    // 水平方向，tmp的每行对应原图的一行
+    CImg<float> tmp(nw, img.height(), 1, img.spectrum());
+    cimg_forYC(img, y, v) {
+        const T *srow = img.data(0, y, 0, v);
+        float *trow = tmp.data(0, y, 0, v);
+        for (int x = 0; x < nw; x++) {
+            const T *s = srow + wx.start[x];
+            const float *w = &wx.weight[x * wx.taps];
+            float sum = 0;
+            for (int k = 0; k < wx.taps; k++) sum += w[k] * s[k];
+            trow[x] = sum;
+        }
+    }
+
+    // 竖直方向，每个输出行为tmp中若干整行的加权和
+    std::vector<float> acc(nw);
+    cimg_forYC(re, y, v) {
+        std::fill(acc.begin(), acc.end(), 0.0f);
+        for (int k = 0; k < wy.taps; k++) {
+            float w = wy.weight[y * wy.taps + k];
+            if (w == 0) continue;
+            const float *trow = tmp.data(0, wy.start[y] + k, 0, v);
+            for (int x = 0; x < nw; x++) acc[x] += w * trow[x];
+        }
+        T *drow = re.data(0, y, 0, v);
+        for (int x = 0; x < nw; x++) storePixel(drow[x], acc[x]);
+    }
+    return re;
+}
+
+// 求出使EPS <= ox0 + dox * x < w且EPS <= oy0 + doy * x < h成立的x的区间[xs, xe]，
+// x限定在[0, n - 1]内，返回false表示区间为空
+// 先解析地解出区间，再用原判定条件修正区间两端的舍入误差
+bool clipSpan(double ox0, double dox, double oy0, double doy, double w, double h, int n, int &xs, int &xe) {
+    double lo = -1, hi = n;
+    double o0[2] = {ox0, oy0}, d[2] = {dox, doy}, lim[2] = {w, h};
+    for (int i = 0; i < 2; i++) {
+        if (fabs(d[i]) < 1e-12) {
+            if (o0[i] < EPS || o0[i] >= lim[i]) return false;
+            continue;
+        }
+        double t1 = (EPS - o0[i]) / d[i], t2 = (lim[i] - o0[i]) / d[i];
+        if (d[i] < 0) std::swap(t1, t2);
+        lo = std::max(lo, t1);
+        hi = std::min(hi, t2);
+    }
+    if (hi < lo) return false;
+    xs = std::max(0, (int)std::ceil(lo) - 1);
+    xe = std::min(n - 1, (int)std::floor(hi) + 1);
+    #define _clipSpan_inside(x) (ox0 + dox * (x) >= EPS && oy0 + doy * (x) >= EPS && \
+                                 ox0 + dox * (x) < w && oy0 + doy * (x) < h)
+    while (xs <= xe && !_clipSpan_inside(xs)) xs++;
+    while (xe >= xs && !_clipSpan_inside(xe)) xe--;
+    #undef _clipSpan_inside
+    return xs <= xe;
+}
+
+// 对dst第y行[xs, xe]内的像素插值，x处对应src中的(ox0 + dox * x, oy0 + doy * x)
+// 行内原图坐标按常数步长递增，C为编译期确定的通道数
+// 邻点都在src内的子区间[is, ie]由clipSpan解出，区间内不截断坐标，两端留EPS抵消步进的累积误差
+template <class K, int C, typename T, typename D>
+void sampleSpan(CImg<T> const &src, double ox0, double dox, double oy0, double doy,
+                CImg<D> &dst, int y, int xs, int xe) {
+    int is, ie;
+    if (!clipSpan(ox0 - K::before, dox, oy0 - K::before, doy, src.width() - K::before - K::after - EPS,
+                  src.height() - K::before - K::after - EPS, xe + 1, is, ie) || (is = std::max(is, xs)) > ie) {
+        is = xe + 1;
+        ie = xe;
+    }
+    double ox = ox0 + dox * xs, oy = oy0 + doy * xs;
+    int x = xs;
+    for (; x < is; x++, ox += dox, oy += doy) K::template sample<C>(src, ox, oy, dst, x, y);
+    for (; x <= ie; x++, ox += dox, oy += doy) K::template sampleInside<C>(src, ox, oy, dst, x, y);
+    for (; x <= xe; x++, ox += dox, oy += doy) K::template sample<C>(src, ox, oy, dst, x, y);
+}
+
+// 按dst的通道数选择展开后的版本，灰度图和RGB图之外的按实际通道数循环
+template <class K, typename T, typename D>
+void sampleSpan(CImg<T> const &src, double ox0, double dox, double oy0, double doy,
+                CImg<D> &dst, int y, int xs, int xe) {
+    switch (dst.spectrum()) {
+        case 1:  sampleSpan<K, 1>(src, ox0, dox, oy0, doy, dst, y, xs, xe); break;
+        case 3:  sampleSpan<K, 3>(src, ox0, dox, oy0, doy, dst, y, xs, xe); break;
+        default: sampleSpan<K, 0>(src, ox0, dox, oy0, doy, dst, y, xs, xe);
+    }
+}
+
+// 用指定的插值核K将图片缩放size倍，输出像素中心对应原图中的(x + 0.5) / size - 0.5
+template <class K, typename T>
+CImg<T> myresize(CImg<T>& img, double size) {
     if (size == 1) return img;
     unsigned int nw = img.width() * size, nh = img.height() * size;
-    CImg<unsigned char> re(nw, nh, 1, 1, 0);
-    cimg_forXY(re, x, y) {
-
-        // // 双线性插值
-        // double ox = x / size, oy = y / size;
-        // unsigned int ix0 = (unsigned int)ox, iy0 = (unsigned int)oy;
-        // unsigned int ix1 = (ix0 + 1 >= img.width() ? ix0 : ix0 + 1), \
-        //     iy1 = (iy0 + 1 >= img.height() ? iy0 : iy0 + 1);
-        // double px = ox - ix0, py = oy - iy0;
-        // double color = img(ix0, iy0) * (1- px) * (1 - py) + \
-        //                img(ix1, iy0) * px * (1- py) + \
-        //                img(ix0, iy1) * (1 - px) * py + \
-        //                img(ix1, iy1) * px * py;
-
-        // re(x, y) = std::floor(color + 0.5);
-
-        double ox = x / size, oy = y / size, oxx = (x + 1) / size, oyy = (y + 1) / size;
-        unsigned int xlu = std::floor(ox), ylu = std::floor(oy), \
-            xrd = std::ceil(oxx), yrd = std::ceil(oyy);
-        double csum = 0.0, psum = 0.0, p = 1.0;
-        for (unsigned int i = xlu; i < xrd; i++) {
-            for (unsigned int j = ylu; j < yrd; j++) {
-                p = 1.0;
-                if (x < ox) p *= (1 - (ox - x));
-                else if (x > oxx) p *= (1 - (x - oxx));
-                if (y < ox) p *= (1 - (oy - y));
-                else if (y > oyy) p *= (1 - (y - oyy));
-                csum += img(i, j) * p;
-                psum += p;
+    CImg<T> re(nw, nh, 1, img.spectrum(), 0);
+    cimg_forY(re, y) sampleSpan<K>(img, 0.5 / size - 0.5, 1 / size, (y + 0.5) / size - 0.5, 0, re, y, 0, re.width() - 1);
+    return re;
+}
+
+// 分块旋转90度(CW为true，顺时针)或270度，每次处理TILE*TILE的一块，
+// 块内读取的原图行和写入的结果行都留在缓存中
+// 原图(sx, sy)顺时针旋转90度后位于(h - 1 - sy, sx)，旋转270度后位于(sy, w - 1 - sx)
+template <bool CW, typename T>
+void quarterTurn(CImg<T> const &img, CImg<T> &re) {
+    const int TILE = 16;
+    int w = img.width(), h = img.height(), stride = re.width();
+    cimg_forC(img, v) {
+        for (int sy0 = 0; sy0 < h; sy0 += TILE) {
+            int sy1 = std::min(sy0 + TILE, h);
+            for (int sx0 = 0; sx0 < w; sx0 += TILE) {
+                int sx1 = std::min(sx0 + TILE, w);
+                for (int sy = sy0; sy < sy1; sy++) {
+                    const T *s = img.data(0, sy, 0, v);
+                    T *d = CW ? re.data(h - 1 - sy, sx0, 0, v)
+                                          : re.data(sy, w - 1 - sx0, 0, v);
+                    for (int sx = sx0; sx < sx1; sx++, d += CW ? stride : -stride) *d = s[sx];
+                }
             }
         }
-        re(x, y) = (unsigned char)(csum / psum);
     }
-    return re;
 }
 
 // 用于将图片顺时针旋转90、180、270
-CImg<unsigned char> mytran(CImg<unsigned char>& img, unsigned int t) {
+template <typename T>
+CImg<T> mytran(CImg<T>& img, unsigned int t) {
     switch(t) {
         case 1: {
             // 旋转90
-            CImg<unsigned char> re(img.height(), img.width());
-            cimg_forXY(re, x, y) {
-                re(x, y) = img(y, img.width() - x);
-            }
+            CImg<T> re(img.height(), img.width(), 1, img.spectrum());
+            quarterTurn<true>(img, re);
             return re;
-            break;
         }
         case 2: {
-            // 旋转180
-            CImg<unsigned char> re(img.width(), img.height());
-            cimg_forXY(re, x, y) {
-                re(x, y) = img(img.width() - x, img.width() - y);
-            }
+            // 旋转180，即每个通道的数据倒序
+            CImg<T> re(img.width(), img.height(), 1, img.spectrum());
+            unsigned long n = (unsigned long)img.width() * img.height();
+            cimg_forC(img, v) std::reverse_copy(img.data(0, 0, 0, v), img.data(0, 0, 0, v) + n, re.data(0, 0, 0, v));
             return re;
-            break;
         }
         case 3: {
             // 旋转270
-            CImg<unsigned char> re(img.height(), img.width());
-            cimg_forXY(re, x, y) {
-                re(x, y) = img(img.height() - y, x);
-            }
+            CImg<T> re(img.height(), img.width(), 1, img.spectrum());
+            quarterTurn<false>(img, re);
             return re;
-            break;
         }
         default: {
             // 不旋转
-            CImg<unsigned char> re(img);
+            CImg<T> re(img);
             return re;
         }
     }
 }
 
-// 用于旋转图片，angle为一平面角
-CImg<unsigned char> myrotate(CImg<unsigned char>& img, double angle) {
+// 用于旋转图片，angle为一平面角，K为插值核
+// 结果图中每一行对应原图中的一条直线段，该行内原图坐标按常数步长变化，
+// 因此先解析地求出该行落在原图内的区间，只对区间内的像素插值，区间外的角落保持为0
+template <class K, typename T>
+CImg<T> myrotate(CImg<T>& img, double angle) {
     unsigned int angle2 = (unsigned int)angle % 360;
-    CImg<unsigned char> tranedImg = mytran(img, angle2 / 90);
+    CImg<T> tranedImg = mytran(img, angle2 / 90);
     angle2 %= 90;
     if (angle2 == 0) return tranedImg;
 
     angle = angle2 + (angle - (unsigned int)angle);
-    angle = angle / 180 * pi;
+    angle = angle / 180 * cimg::PI;
+    double cosa = std::cos(angle), sina = std::sin(angle);
+    int tw = tranedImg.width(), th = tranedImg.height();
 
-    unsigned int nw = tranedImg.width() * std::sin(angle) + tranedImg.height() * std::cos(angle), \
-        nh = tranedImg.width() * std::cos(angle) + tranedImg.height() * std::sin(angle);
+    unsigned int nw = tw * cosa + th * sina, \
+        nh = tw * sina + th * cosa;
 
-    CImg<unsigned char> re(nw, nh, 1, 1, 0);
-    double transMidx = tranedImg.width() / 2.0, transMidy = tranedImg.height() / 2.0, \
+    CImg<T> re(nw, nh, 1, tranedImg.spectrum(), 0);
+    double transMidx = tw / 2.0, transMidy = th / 2.0, \
            resMidX = re.width() / 2.0, resMidy = re.height() / 2.0;
 
-    cimg_forXY(re, x, y) {
-        // 遍历旋转后图片的像素点，计算出对应的原图中的位置，若无对应则跳过
-        // 先把坐标系转换为以图像中心为原点的极坐标系，计算后再将极坐标系转换为直角坐标
-        double ox = transMidx + std::cos(angle) * (x - resMidX) - std::sin(angle) * (resMidy - y), \
-               oy = transMidy - std::sin(angle) * (x - resMidX) - std::cos(angle) * (resMidy - y);
+    cimg_forY(re, y) {
+        // 计算出该行x = 0处对应的原图中的位置，x每加1，ox增加cosa，oy减少sina
+        // 先把坐标系转换为以图像中心为原点的坐标系，旋转后再转换回原图坐标
+        double ox0 = transMidx - cosa * resMidX - sina * (resMidy - y),
+               oy0 = transMidy + sina * resMidX - cosa * (resMidy - y);
 
-        if (ox < EPS || oy < EPS || ox >= tranedImg.width() ||  oy >= tranedImg.height()) {
-            continue;
+        int xs, xe;
+        if (clipSpan(ox0, cosa, oy0, -sina, tw, th, nw, xs, xe))
+            sampleSpan<K>(tranedImg, ox0, cosa, oy0, -sina, re, y, xs, xe);
+    }
+    return re;
+}
+
+template <typename T>
+CImg<T> myrotate(CImg<T>& img, double angle) {
+    return myrotate<BilinearKernel>(img, angle);
+}
+
+// 对每一行做一维平移重采样：dst(x, y) = src(x + shift, y + dy)，其中shift = k * y + b
+// 同一行的平移量相同，两个线性插值权重在整行内不变；落在src外的部分为0
+// src与dst可以是不同的像素类型，第一次错切直接读原图，最后一次直接写结果图
+template <typename S, typename D>
+void shearRows(CImg<S> const &src, CImg<D> &dst, double k, double b, int dy) {
+    int ws = src.width(), wd = dst.width();
+    cimg_forC(dst, v) {
+#ifdef cimg_use_openmp
+#pragma omp parallel for
+#endif
+        for (int y = 0; y < dst.height(); y++) {
+            double shift = k * y + b;
+            int i0 = (int)std::floor(shift);
+            float f = (float)(shift - i0), g = 1 - f;
+            D *d = dst.data(0, y, 0, v);
+            const S *s = src.data(0, y + dy, 0, v) + i0;
+            std::fill(d, d + wd, (D)0);
+
+            // [lo, hi)内两个邻点都在src中，两端各有一个像素只有一个邻点
+            int lo = std::max(0, -i0), hi = std::min(wd, ws - 1 - i0);
+            for (int x = lo; x < hi; x++) storePixel(d[x], s[x] * g + s[x + 1] * f);
+            if (-i0 - 1 >= 0 && -i0 - 1 < wd) storePixel(d[-i0 - 1], s[-i0] * f);
+            if (ws - 1 - i0 >= 0 && ws - 1 - i0 < wd) storePixel(d[ws - 1 - i0], s[ws - 1 - i0] * g);
         }
-        
-        // 双线性插值
-        unsigned int ix0 = (unsigned int)ox, iy0 = (unsigned int)oy;
-        unsigned int ix1 = (ix0 + 1 >= tranedImg.width() ? ix0 : ix0 + 1), \
-            iy1 = (iy0 + 1 >= tranedImg.height() ? iy0 : iy0 + 1);
-        double px = ox - ix0, py = oy - iy0;
-        double color = tranedImg(ix0, iy0) * (1- px) * (1 - py) + \
-                       tranedImg(ix1, iy0) * px * (1- py) + \
-                       tranedImg(ix0, iy1) * (1 - px) * py + \
-                       tranedImg(ix1, iy1) * px * py;
+    }
+}
 
-        re(x, y) = std::floor(color + 0.5);
+// 对每一列做一维平移重采样：dst(x, y) = src(x, y + shift)，其中shift = k * x + b
+// 按STRIP列一条分条处理，条内各列的平移量相近，读写的行片段都留在缓存中
+void shearColumns(CImg<float> const &src, CImg<float> &dst, double k, double b) {
+    const int STRIP = 64;
+    int hs = src.height(), hd = dst.height(), w = dst.width();
+    std::vector<int> i0(w);
+    std::vector<float> f(w);
+    for (int x = 0; x < w; x++) {
+        double shift = k * x + b;
+        i0[x] = (int)std::floor(shift);
+        f[x] = (float)(shift - i0[x]);
+    }
+    dst.fill(0);
+    cimg_forC(dst, v) {
+#ifdef cimg_use_openmp
+#pragma omp parallel for
+#endif
+        for (int x0 = 0; x0 < w; x0 += STRIP) {
+            int x1 = std::min(x0 + STRIP, w);
+            int imin = *std::min_element(&i0[x0], &i0[0] + x1),
+                imax = *std::max_element(&i0[x0], &i0[0] + x1);
+            // 只处理条内至少有一列落在src中的行
+            int ylo = std::max(0, -imax - 1), yhi = std::min(hd, hs - imin);
+            const float *s = src.data(0, 0, 0, v);
+            long ws = src.width();
+            for (int y = ylo; y < yhi; y++) {
+                float *d = dst.data(0, y, 0, v);
+                if (y + imin >= 0 && y + imax + 1 < hs) {
+                    // 条内所有列的两个邻点都在src中
+                    for (int x = x0; x < x1; x++) {
+                        const float *p = s + (y + i0[x]) * ws + x;
+                        d[x] = p[0] * (1 - f[x]) + p[ws] * f[x];
+                    }
+                } else {
+                    for (int x = x0; x < x1; x++) {
+                        int sy = y + i0[x];
+                        float p0 = (sy >= 0 && sy < hs) ? s[sy * ws + x] : 0,
+                              p1 = (sy + 1 >= 0 && sy + 1 < hs) ? s[(sy + 1) * ws + x] : 0;
+                        d[x] = p0 * (1 - f[x]) + p1 * f[x];
+                    }
+                }
+            }
+        }
     }
+}
+
+// 用三次错切(Paeth)旋转图片，angle为一平面角，结果的大小和位置与myrotate相同
+// 旋转矩阵分解为X(a)Y(b)X(a)，a = -tan(angle / 2)，b = sin(angle)，
+// 每次错切都是沿行或沿列的一维重采样，同一行(列)内插值权重不变，
+// 访存按行顺序或按列条进行，适合大于缓存的图像
+// 第一次错切直接读mytran的结果，最后一次直接写入结果图，中间只用两幅浮点图像交替
+template <typename T>
+CImg<T> myrotateShear(CImg<T>& img, double angle) {
+    unsigned int angle2 = (unsigned int)angle % 360;
+    CImg<T> tranedImg = mytran(img, angle2 / 90);
+    angle2 %= 90;
+    if (angle2 == 0) return tranedImg;
+
+    angle = angle2 + (angle - (unsigned int)angle);
+    angle = angle / 180 * cimg::PI;
+    double a = -std::tan(angle / 2), b = std::sin(angle);
+    int w0 = tranedImg.width(), h0 = tranedImg.height();
+    int nw = w0 * std::cos(angle) + h0 * b, nh = w0 * b + h0 * std::cos(angle);
+
+    // 以像素中心到图像中心的距离为坐标，dst中u处取src中u - a * v处
+    // 即src中的x = x' + (ws - wd) / 2 - a * (y + dy + 0.5 - hs / 2)
+    int c = tranedImg.spectrum();
+    int w1 = (int)std::ceil(w0 + fabs(a) * h0);
+    CImg<float> img1(w1, h0, 1, c);
+    shearRows(tranedImg, img1, -a, (w0 - w1) / 2.0 - a * (0.5 - h0 / 2.0), 0);
+    tranedImg.assign();
+
+    // Y方向错切，src中的y = y' + (hs - hd) / 2 - b * (x + 0.5 - w / 2)
+    int h2 = (int)std::ceil(h0 + b * w1);
+    CImg<float> img2(w1, h2, 1, c);
+    shearColumns(img1, img2, -b, (h0 - h2) / 2.0 - b * (0.5 - w1 / 2.0));
+    img1.assign();
+
+    // 最后一次X方向错切，直接裁剪到结果大小并转为原图的像素类型
+    CImg<T> re(nw, nh, 1, c);
+    int dy = (h2 - nh) / 2;
+    shearRows(img2, re, -a, (w1 - nw) / 2.0 - a * (dy + 0.5 - h2 / 2.0), dy);
     return re;
 }
 
+// 仿射变换的组合，rotate、scale、translate、crop依次累积到同一个矩阵中，
+// 最后由apply只重采样一次，避免每一步都分配新图像并重复插值
+// A为由原图坐标到结果坐标的前向矩阵[A0 A1 A2; A3 A4 A5]，w、h为当前画布大小
+struct AffineChain {
+    double A[6];
+    int w, h;
+
+    AffineChain(int w, int h) : w(w), h(h) {
+        A[0] = 1; A[1] = 0; A[2] = 0;
+        A[3] = 0; A[4] = 1; A[5] = 0;
+    }
+
+    // 左乘变换[t0 t1 t2; t3 t4 t5]
+    AffineChain &then(double t0, double t1, double t2, double t3, double t4, double t5) {
+        double B[6] = {t0 * A[0] + t1 * A[3], t0 * A[1] + t1 * A[4], t0 * A[2] + t1 * A[5] + t2,
+                       t3 * A[0] + t4 * A[3], t3 * A[1] + t4 * A[4], t3 * A[2] + t4 * A[5] + t5};
+        for (int i = 0; i < 6; i++) A[i] = B[i];
+        return *this;
+    }
+
+    // 绕画布中心顺时针旋转angle度，画布扩大为旋转后的包围盒，与myrotate一致
+    AffineChain &rotate(double angle) {
+        angle = angle / 180 * cimg::PI;
+        double c = std::cos(angle), s = std::sin(angle);
+        int nw = w * fabs(c) + h * fabs(s), nh = w * fabs(s) + h * fabs(c);
+        double cx = w / 2.0, cy = h / 2.0, ncx = nw / 2.0, ncy = nh / 2.0;
+        w = nw;
+        h = nh;
+        return then(c, -s, ncx - c * cx + s * cy, s, c, ncy - s * cx - c * cy);
+    }
+
+    // 缩放size倍，像素中心对齐，与myresize<K>一致
+    AffineChain &scale(double size) {
+        w = w * size;
+        h = h * size;
+        return then(size, 0, 0.5 * size - 0.5, 0, size, 0.5 * size - 0.5);
+    }
+
+    AffineChain &translate(double dx, double dy) {
+        return then(1, 0, dx, 0, 1, dy);
+    }
+
+    // 只保留画布中以(x0, y0)为左上角、大小为cw*ch的部分
+    AffineChain &crop(int x0, int y0, int cw, int ch) {
+        w = cw;
+        h = ch;
+        return then(1, 0, -x0, 0, 1, -y0);
+    }
+
+    // 用插值核K将组合后的变换作用于img，结果中没有对应原图的部分为0
+    // 原图像素(x, y)覆盖[x - 0.5, x + 0.5)，落在原图覆盖范围内的点都会被插值
+    template <class K, typename T>
+    CImg<T> apply(CImg<T> const &img) const {
+        CImg<T> re(std::max(w, 0), std::max(h, 0), 1, img.spectrum(), 0);
+        double det = A[0] * A[4] - A[1] * A[3];
+        if (re.is_empty() || fabs(det) < 1e-12) return re;
+
+        // 逆矩阵，由结果坐标映射回原图坐标
+        double M[6] = { A[4] / det, -A[1] / det, (A[1] * A[5] - A[4] * A[2]) / det,
+                       -A[3] / det,  A[0] / det, (A[3] * A[2] - A[0] * A[5]) / det};
+        cimg_forY(re, y) {
+            double ox0 = M[1] * y + M[2], oy0 = M[4] * y + M[5];
+            int xs, xe;
+            if (clipSpan(ox0 + 0.5, M[0], oy0 + 0.5, M[3], img.width(), img.height(), re.width(), xs, xe))
+                sampleSpan<K>(img, ox0, M[0], oy0, M[3], re, y, xs, xe);
+        }
+        return re;
+    }
+
+    template <typename T>
+    CImg<T> apply(CImg<T> const &img) const {
+        return apply<BilinearKernel>(img);
+    }
+};
+
 // 返回点p0到p1、p2所成直线的距离
 double dist(point p0, point p1, point p2) {
     return std::fabs((p2.y - p1.y) * p0.x + (p1.x - p2.x) * p0.y + \
@@ -144,51 +609,382 @@ double dist(point p0, point p1) {
     return std::sqrt(std::pow(p0.y - p1.y, 2) + std::pow(p0.x - p1.x, 2));
 }
 
-// 画出由p1 p2 p3三点确定的矩形（平行四边形），若不是矩形会有提示，bound为边宽
-void drawrectangle(CImg<unsigned char>& img, point p1, point p2, point p3, unsigned int bound) {
-    double d12 = dist(p1, p2), d13 = dist(p1, p3), d23 = dist(p2, p3);
+// 将第y行[xs, xe]内的像素置为color，color[v]为第v个通道的值，区间先截断到图像内
+template <typename T>
+void fillSpan(CImg<T>& img, int y, int xs, int xe, T const *color) {
+    if (y < 0 || y >= img.height()) return;
+    xs = std::max(xs, 0);
+    xe = std::min(xe, img.width() - 1);
+    if (xs > xe) return;
+    cimg_forC(img, v) std::fill(img.data(xs, y, 0, v), img.data(xe, y, 0, v) + 1, color[v]);
+}
 
-    // 确保p2、p3在矩形中是相对的两点，同时确定是否是矩形
-    if (fabs(d12 * d12 + d13 * d13 - d23 * d23) >= EPS) {
-        if (fabs(d13 * d13 + d23 * d23 - d12 * d12) < EPS) {
-            std::swap(p1, p3);
-            std::swap(d12, d23);
-        } else if (fabs(d12 * d12 + d23 * d23 - d13 * d13) < EPS) {
-            std::swap(p1, p2);
-            std::swap(d13, d23);
+// 图像中x0 <= x <= x1、y0 <= y <= y1的矩形区域，用于把绘制限制在图像的一块内
+struct ClipRect {
+    int x0, y0, x1, y1;
+    ClipRect(int x0, int y0, int x1, int y1) : x0(x0), y0(y0), x1(x1), y1(y1) {}
+    template <typename T>
+    ClipRect(CImg<T> const &img) : x0(0), y0(0), x1(img.width() - 1), y1(img.height() - 1) {}
+};
+
+// 凸多边形P[0]...P[n - 1]的走向，逆时针(y轴向下时为顺时针)为1，反之为-1，退化为线段或点时为0
+double polygonOrientation(point const *P, int n) {
+    double area = 0;
+    for (int i = 0; i < n; i++) area += P[i].x * P[(i + 1) % n].y - P[(i + 1) % n].x * P[i].y;
+    return fabs(area) < EPS ? 0 : (area > 0 ? 1 : -1);
+}
+
+// 将[lo, hi]缩小为与凸多边形P在第y行上的区间的交集，s为P的走向，返回false表示交集为空
+// 每条边所在的半平面在一行内是对x的一个线性约束，内侧满足s * ((b - a) x (p - a)) >= 0，整理为A * x + B >= 0
+bool convexSpan(point const *P, int n, double s, double y, double &lo, double &hi) {
+    for (int i = 0; i < n; i++) {
+        point const &a = P[i], &b = P[(i + 1) % n];
+        double A = -s * (b.y - a.y), B = s * ((b.x - a.x) * (y - a.y) + (b.y - a.y) * a.x);
+        if (fabs(A) < 1e-12) {
+            if (B < 0) return false;
+        } else if (A > 0) {
+            lo = std::max(lo, -B / A);
         } else {
-            std::cout << "WARRANTY: Not a rectangle.\n";
+            hi = std::min(hi, -B / A);
         }
     }
+    return lo <= hi;
+}
+
+// 扫描转换凸多边形P[0]...P[n - 1]，填充像素中心落在多边形内的像素
+// 逐行由convexSpan求出填充区间，只访问多边形包围盒与clip相交部分内的行
+template <typename T>
+void fillConvexPolygon(CImg<T>& img, point const *P, int n, T const *color, ClipRect const &clip) {
+    double s = polygonOrientation(P, n), ymin = P[0].y, ymax = P[0].y;
+    if (s == 0) return;
+    for (int i = 1; i < n; i++) {
+        ymin = std::min(ymin, P[i].y);
+        ymax = std::max(ymax, P[i].y);
+    }
 
-    // 类似画直角三角形，根据对称性画出矩形（平行四边形）
-    unsigned int mx = p2.x + p3.x, my = p2.y + p3.y;
-    cimg_forXY(img, x, y) {
-        point p0(x, y);
-        if (  (dist(p0, p1, p2) < bound / 2 && dist(p0, p1) + dist(p0, p2) < d12 + bound)
-           || (dist(p0, p1, p3) < bound / 2 && dist(p0, p1) + dist(p0, p3) < d13 + bound)) {
-            img(p0.x, p0.y) = 0;
-            img(mx - p0.x, my - p0.y) = 0;
+    int ys = std::max(clip.y0, (int)std::ceil(ymin)), ye = std::min(clip.y1, (int)std::floor(ymax));
+    for (int y = ys; y <= ye; y++) {
+        double lo = clip.x0, hi = clip.x1;
+        if (convexSpan(P, n, s, y, lo, hi)) fillSpan(img, y, (int)std::ceil(lo), (int)std::floor(hi), color);
+    }
+}
+
+template <typename T>
+void fillConvexPolygon(CImg<T>& img, point const *P, int n, T color) {
+    std::vector<T> c(img.spectrum(), color);
+    fillConvexPolygon(img, P, n, &c[0], ClipRect(img));
+}
+
+// p1、p2间宽为width的线段所占的矩形，以线段为中轴、两端各延长width / 2，四个角点写入Q
+void thickLineQuad(point p1, point p2, double width, point *Q) {
+    double d = dist(p1, p2), hw = width / 2;
+    // 沿线段方向的半宽向量(ux, uy)及其法向(-uy, ux)
+    double ux = d < EPS ? hw : (p2.x - p1.x) / d * hw, uy = d < EPS ? 0 : (p2.y - p1.y) / d * hw;
+    Q[0] = point(p1.x - ux - uy, p1.y - uy + ux);
+    Q[1] = point(p2.x + ux - uy, p2.y + uy + ux);
+    Q[2] = point(p2.x + ux + uy, p2.y + uy - ux);
+    Q[3] = point(p1.x - ux + uy, p1.y - uy - ux);
+}
+
+// 画出p1、p2间宽为width的线段
+template <typename T>
+void drawThickLine(CImg<T>& img, point p1, point p2, double width, T const *color, ClipRect const &clip) {
+    point Q[4];
+    thickLineQuad(p1, p2, width, Q);
+    fillConvexPolygon(img, Q, 4, color, clip);
+}
+
+template <typename T>
+void drawThickLine(CImg<T>& img, point p1, point p2, double width, T color) {
+    std::vector<T> c(img.spectrum(), color);
+    drawThickLine(img, p1, p2, width, &c[0], ClipRect(img));
+}
+
+// 画出以c为圆心、r为半径、宽为width的圆环，即满足|dist(p, c) - r| < width / 2的像素
+// 逐行由内外两个圆求出至多两段填充区间，每行至多开两次方
+template <typename T>
+void drawRing(CImg<T>& img, point c, double r, double width, T const *color, ClipRect const &clip) {
+    double ro = r + width / 2, ri = r - width / 2;
+    int ys = std::max(clip.y0, (int)std::floor(c.y - ro)), ye = std::min(clip.y1, (int)std::ceil(c.y + ro));
+    for (int y = ys; y <= ye; y++) {
+        double dy2 = (y - c.y) * (y - c.y), so2 = ro * ro - dy2;
+        if (so2 <= 0) continue;
+        double so = std::sqrt(so2);
+        int xs = std::max(clip.x0, (int)std::floor(c.x - so) + 1),
+            xe = std::min(clip.x1, (int)std::ceil(c.x + so) - 1);
+        double si2 = ri > 0 ? ri * ri - dy2 : -1;
+        if (si2 < 0) {
+            fillSpan(img, y, xs, xe, color);
+        } else {
+            // 内圆上及内圆中的像素不画
+            double si = std::sqrt(si2);
+            fillSpan(img, y, xs, std::min(xe, (int)std::ceil(c.x - si) - 1), color);
+            fillSpan(img, y, std::max(xs, (int)std::floor(c.x + si) + 1), xe, color);
         }
     }
 }
 
-// 画出由p1 p2 p3三点确定的三角形，bound为边宽
-void drawreiangle(CImg<unsigned char>& img, point p1, point p2, point p3, unsigned int bound) {
+template <typename T>
+void drawRing(CImg<T>& img, point c, double r, double width, T color) {
+    std::vector<T> cl(img.spectrum(), color);
+    drawRing(img, c, r, width, &cl[0], ClipRect(img));
+}
+
+// 确保p2、p3在矩形中是相对的两点，即p1为直角顶点，三点不构成直角时不调整顺序并返回false
+bool rectangleCorner(point &p1, point &p2, point &p3) {
     double d12 = dist(p1, p2), d13 = dist(p1, p3), d23 = dist(p2, p3);
-    cimg_forXY(img, x, y) {
-        point p0(x, y);
-        if (  (dist(p0, p1, p2) < bound / 2 && dist(p0, p1) + dist(p0, p2) < d12 + bound)
-           || (dist(p0, p1, p3) < bound / 2 && dist(p0, p1) + dist(p0, p3) < d13 + bound)
-           || (dist(p0, p2, p3) < bound / 2 && dist(p0, p2) + dist(p0, p3) < d23 + bound))
-            img(x, y) = 0;
+    if (fabs(d12 * d12 + d13 * d13 - d23 * d23) < EPS) return true;
+    if (fabs(d13 * d13 + d23 * d23 - d12 * d12) < EPS) {
+        std::swap(p1, p3);
+        return true;
+    }
+    if (fabs(d12 * d12 + d23 * d23 - d13 * d13) < EPS) {
+        std::swap(p1, p2);
+        return true;
     }
+    return false;
+}
+
+// 画出以p1为顶点、p1p2与p1p3为两边的平行四边形的边框
+// p4为p1的对角，四条边分别画出，超出clip的部分被截断
+template <typename T>
+void drawParallelogram(CImg<T>& img, point p1, point p2, point p3, double bound, T const *color, ClipRect const &clip) {
+    point p4(p2.x + p3.x - p1.x, p2.y + p3.y - p1.y);
+    drawThickLine(img, p1, p2, bound, color, clip);
+    drawThickLine(img, p1, p3, bound, color, clip);
+    drawThickLine(img, p4, p2, bound, color, clip);
+    drawThickLine(img, p4, p3, bound, color, clip);
+}
+
+// 画出由p1 p2 p3三点确定的矩形（平行四边形），若不是矩形会有提示，bound为边宽
+void drawrectangle(CImg<unsigned char>& img, point p1, point p2, point p3, unsigned int bound) {
+    if (!rectangleCorner(p1, p2, p3)) std::cout << "WARRANTY: Not a rectangle.\n";
+    std::vector<unsigned char> black(img.spectrum(), 0);
+    drawParallelogram(img, p1, p2, p3, bound, &black[0], ClipRect(img));
+}
+
+// 画出由p1 p2 p3三点确定的三角形，bound为边宽
+void drawreiangle(CImg<unsigned char>& img, point p1, point p2, point p3, unsigned int bound) {
+    unsigned char black = 0;
+    drawThickLine(img, p1, p2, bound, black);
+    drawThickLine(img, p1, p3, bound, black);
+    drawThickLine(img, p2, p3, bound, black);
 }
 
 // 画出以p1为原点，r为半径的圆，bound为边宽
 void drawcicle(CImg<unsigned char>& img, point p1, unsigned int r, unsigned int bound) {
-    cimg_forXY(img, x, y) {
-        point p0(x, y);
-        if (fabs(dist(p0, p1) - r) < bound / 2) img(x, y) = 0;
+    drawRing(img, p1, r, bound, (unsigned char)0);
+}
+
+// 合成图像中的一个图形，type为'r'矩形、't'三角形、'c'圆
+// 矩形与三角形由p1 p2 p3确定，含义同drawrectangle与drawreiangle；圆以p1为圆心、r为半径；bound为边宽
+struct ShapeParam {
+    char type;
+    point p1, p2, p3;
+    double r, bound;
+};
+
+// 从参数流中读入一幅图像的所有图形，格式为图形个数n，随后n个图形，每个图形为以下之一：
+// r x1 y1 x2 y2 x3 y3 bound
+// t x1 y1 x2 y2 x3 y3 bound
+// c x y r bound
+// 读到流末尾时返回false，记录不完整或格式错误时抛出CImgIOException
+bool readShapes(std::istream &in, std::vector<ShapeParam> &shapes) {
+    int n;
+    if (!(in >> n)) {
+        if (in.eof()) return false;
+        throw CImgIOException("readShapes(): bad shape count.");
+    }
+    if (n < 0) throw CImgIOException("readShapes(): negative shape count %d.", n);
+    shapes.resize(n);
+    for (int i = 0; i < n; i++) {
+        ShapeParam &s = shapes[i];
+        in >> s.type >> s.p1.x >> s.p1.y;
+        if (s.type == 'c') in >> s.r;
+        else in >> s.p2.x >> s.p2.y >> s.p3.x >> s.p3.y;
+        in >> s.bound;
+        if (!in || (s.type != 'r' && s.type != 't' && s.type != 'c'))
+            throw CImgIOException("readShapes(): shape %d of %d is malformed.", i + 1, n);
+        if (s.type == 'r') rectangleCorner(s.p1, s.p2, s.p3);
     }
+    return true;
+}
+
+// 画布池，保存一批大小相同、背景色相同的画布，反复使用而不重新分配
+// 每块画布记录画过的区域，复用前只把该区域恢复为背景色，不必清空整幅画布
+struct CanvasPool {
+    unsigned char background;
+    std::vector< CImg<unsigned char> > canvas;
+    std::vector<ClipRect> dirty;
+
+    CanvasPool(int n, int w, int h, int spectrum, unsigned char background)
+        : background(background), canvas(n, CImg<unsigned char>(w, h, 1, spectrum, background)),
+          dirty(n, ClipRect(0, 0, -1, -1)) {}
+
+    // 将第i块画布上的区域box标记为画过，box为(x0, y0) - (x1, y1)，可以超出画布
+    void mark(int i, double x0, double y0, double x1, double y1) {
+        CImg<unsigned char> const &img = canvas[i];
+        ClipRect &d = dirty[i];
+        int bx0 = std::max(0, (int)std::floor(x0)), by0 = std::max(0, (int)std::floor(y0)),
+            bx1 = std::min(img.width() - 1, (int)std::ceil(x1)), by1 = std::min(img.height() - 1, (int)std::ceil(y1));
+        if (bx0 > bx1 || by0 > by1) return;
+        if (d.x0 > d.x1) {
+            d = ClipRect(bx0, by0, bx1, by1);
+        } else {
+            d.x0 = std::min(d.x0, bx0); d.y0 = std::min(d.y0, by0);
+            d.x1 = std::max(d.x1, bx1); d.y1 = std::max(d.y1, by1);
+        }
+    }
+
+    // 将第i块画布画过的区域恢复为背景色
+    void reset(int i) {
+        ClipRect &d = dirty[i];
+        std::vector<unsigned char> bg(canvas[i].spectrum(), background);
+        for (int y = d.y0; y <= d.y1; y++) fillSpan(canvas[i], y, d.x0, d.x1, &bg[0]);
+        d = ClipRect(0, 0, -1, -1);
+    }
+};
+
+// 用color将一个图形画到画布池的第i块画布上，并标记画过的区域
+void drawShape(CanvasPool &pool, int i, ShapeParam const &s, unsigned char const *color) {
+    CImg<unsigned char> &img = pool.canvas[i];
+    ClipRect clip(img);
+    double e = s.bound / 2 + 1;
+    if (s.type == 'c') {
+        drawRing(img, s.p1, s.r, s.bound, color, clip);
+        pool.mark(i, s.p1.x - s.r - e, s.p1.y - s.r - e, s.p1.x + s.r + e, s.p1.y + s.r + e);
+        return;
+    }
+    // 矩形的第四个顶点为p1的对角，三角形只有三个顶点
+    point P[4] = { s.p1, s.p2, s.p3, point(s.p2.x + s.p3.x - s.p1.x, s.p2.y + s.p3.y - s.p1.y) };
+    int n = 4;
+    if (s.type == 'r') {
+        drawParallelogram(img, s.p1, s.p2, s.p3, s.bound, color, clip);
+    } else {
+        drawThickLine(img, s.p1, s.p2, s.bound, color, clip);
+        drawThickLine(img, s.p1, s.p3, s.bound, color, clip);
+        drawThickLine(img, s.p2, s.p3, s.bound, color, clip);
+        n = 3;
+    }
+    double x0 = P[0].x, y0 = P[0].y, x1 = P[0].x, y1 = P[0].y;
+    for (int k = 1; k < n; k++) {
+        x0 = std::min(x0, P[k].x); x1 = std::max(x1, P[k].x);
+        y0 = std::min(y0, P[k].y); y1 = std::max(y1, P[k].y);
+    }
+    pool.mark(i, x0 - e, y0 - e, x1 + e, y1 + e);
+}
+
+// 从参数流in中逐幅读入图形并画到画布池中的画布上，图形为黑色，每画好一幅调用一次sink(img, 序号)
+// 每次读入与画布数相同的一批，同一批的画布之间相互独立，定义cimg_use_openmp时并行绘制
+// sink返回后该画布即被复用，需要保留结果时应在sink中保存或复制，返回生成的图像数
+// 参数流格式错误时抛出readShapes的异常，此前读入的各批已交给sink
+template <class Sink>
+int renderBatch(std::istream &in, CanvasPool &pool, Sink &sink) {
+    int n = pool.canvas.size(), total = 0;
+    if (n < 1) throw CImgArgumentException("renderBatch(): canvas pool is empty.");
+    std::vector< std::vector<ShapeParam> > params(n);
+    std::vector<unsigned char> black(pool.canvas[0].spectrum(), 0);
+    for (;;) {
+        int m = 0;
+        while (m < n && readShapes(in, params[m])) m++;
+
+#ifdef cimg_use_openmp
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int i = 0; i < m; i++)
+            for (int k = 0; k < (int)params[i].size(); k++) drawShape(pool, i, params[i][k], &black[0]);
+
+        for (int i = 0; i < m; i++) sink(pool.canvas[i], total + i);
+
+#ifdef cimg_use_openmp
+#pragma omp parallel for
+#endif
+        for (int i = 0; i < m; i++) pool.reset(i);
+
+        total += m;
+        if (m < n) return total;
+    }
+}
+
+// 批处理清单中的一项，cols为该行各列，键为列名，值为空的列不记录
+struct ManifestItem {
+    std::map<std::string, std::string> cols;
+
+    // 列name的值，未指定时返回def
+    std::string get(std::string const &name, std::string const &def = "") const {
+        std::map<std::string, std::string>::const_iterator it = cols.find(name);
+        return it == cols.end() ? def : it->second;
+    }
+
+    double getNumber(std::string const &name, double def) const {
+        std::string v = get(name);
+        return v.empty() ? def : std::atof(v.c_str());
+    }
+
+    // 列outputs中是否包含artifact，outputs为以逗号分隔的输出种类，未指定时生成全部输出
+    bool wants(std::string const &artifact) const {
+        std::string v = get("outputs");
+        if (v.empty()) return true;
+        return ("," + v + ",").find("," + artifact + ",") != std::string::npos;
+    }
+};
+
+// 读入TSV格式的批处理清单：第一行为列名，其后每行为一项，各列以制表符分隔
+// 空行与以#开头的行忽略，每行必须有input列，格式错误时抛出CImgIOException
+void readManifest(std::istream &in, std::vector<ManifestItem> &items) {
+    std::vector<std::string> header;
+    std::string line;
+    int lineno = 0;
+    while (std::getline(in, line)) {
+        lineno++;
+        if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        if (line.empty() || line[0] == '#') continue;
+
+        std::vector<std::string> fields;
+        for (std::string::size_type s = 0, e; ; s = e + 1) {
+            e = line.find('\t', s);
+            fields.push_back(line.substr(s, e == std::string::npos ? std::string::npos : e - s));
+            if (e == std::string::npos) break;
+        }
+        if (header.empty()) {
+            header = fields;
+            if (std::find(header.begin(), header.end(), "input") == header.end())
+                throw CImgIOException("readManifest(): header has no 'input' column.");
+            continue;
+        }
+        if (fields.size() > header.size())
+            throw CImgIOException("readManifest(): line %d has %d columns, header has %d.",
+                                  lineno, (int)fields.size(), (int)header.size());
+        ManifestItem item;
+        for (int i = 0; i < (int)fields.size(); i++)
+            if (!fields[i].empty()) item.cols[header[i]] = fields[i];
+        if (item.get("input").empty())
+            throw CImgIOException("readManifest(): line %d has no input.", lineno);
+        items.push_back(item);
+    }
+}
+
+// 解析"k/n"形式的分片参数，表示只处理序号除以n余k的项，格式错误时返回false
+bool parseShard(std::string const &s, int &k, int &n) {
+    return std::sscanf(s.c_str(), "%d/%d", &k, &n) == 2 && n > 0 && k >= 0 && k < n;
+}
+
+// 文件名中最后一个'/'或'\'之后的部分
+std::string baseName(std::string const &path) {
+    std::string::size_type p = path.find_last_of("/\\");
+    return p == std::string::npos ? path : path.substr(p + 1);
+}
+
+// 将目录dir与文件名file连接为路径，dir为空时返回file；使用'/'作分隔符，Windows下同样可用
+std::string joinPath(std::string const &dir, std::string const &file) {
+    if (dir.empty()) return file;
+    char last = dir[dir.size() - 1];
+    return last == '/' || last == '\\' ? dir + file : dir + "/" + file;
+}
+
+bool fileExists(std::string const &filename) {
+    std::FILE *f = std::fopen(filename.c_str(), "rb");
+    if (!f) return false;
+    std::fclose(f);
+    return true;
 }
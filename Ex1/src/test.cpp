@@ -8,9 +8,154 @@
 #include <iostream>
 #include <string>
 #include <cstdlib>
+#include <cstdio>
+#include <fstream>
 #include "myImg.h"
 
-int main() {
+// 保存批量生成的合成图像，文件名为outpath/synth<序号>.bmp
+struct SaveSynth {
+    std::string outpath;
+    void operator()(CImg<unsigned char> const &img, int i) {
+        char buffer[30];
+        std::sprintf(buffer, "%d", i + 1);
+        img.save(joinPath(outpath, std::string("synth") + buffer + ".bmp").c_str());
+    }
+};
+
+// 对一幅图像旋转angle度、缩放size倍，以及两者合成为一次变换，结果分别保存为outpath下的
+// rotate<id>.bmp、resize<id>.bmp、rotresize<id>.bmp，item的outputs列可选择其中一部分(rotate,resize,rotresize)
+// item的rotate列为shear时rotate<id>.bmp改用三次错切旋转(myrotateShear)，适合大于缓存的图像
+void transformImage(std::string const &fname, double angle, double size, std::string const &outpath,
+                    std::string const &id, ManifestItem const &item) {
+    CImg<unsigned char> a(fname.c_str());
+    if (item.wants("rotate")) {
+        CImg<unsigned char> re = item.get("rotate") == "shear" ? myrotateShear(a, angle) : myrotate(a, angle);
+        re.save(joinPath(outpath, "rotate" + id + ".bmp").c_str());
+    }
+    // a.get_rotate(angle).save(outname.c_str());
+
+    if (item.wants("resize"))
+        myresize(a, size).save(joinPath(outpath, "resize" + id + ".bmp").c_str());
+    // a.get_resize(a.width() * size, a.height() * size).save("output/CImgResize.bmp");
+
+    // 旋转后缩放，两步合成为一个仿射变换，只重采样一次
+    if (item.wants("rotresize"))
+        AffineChain(a.width(), a.height()).rotate(angle).scale(size).apply(a)
+            .save(joinPath(outpath, "rotresize" + id + ".bmp").c_str());
+}
+
+// 比较myrotateShear与myrotate对同一幅图像的结果，两者大小须相同，平均每通道差值不超过tol
+// 错切旋转做了三次线性插值，比直接旋转稍模糊，两者不会完全相同
+bool checkShear(CImg<unsigned char> &img, double angle, double tol) {
+    CImg<unsigned char> direct = myrotate(img, angle), shear = myrotateShear(img, angle);
+    if (!direct.is_sameXYZC(shear)) {
+        std::cout << angle << ": size " << shear.width() << "x" << shear.height()
+                  << ", expected " << direct.width() << "x" << direct.height() << std::endl;
+        return false;
+    }
+    double sum = 0;
+    int maxDiff = 0;
+    cimg_foroff(direct, off) {
+        int d = std::abs((int)direct[off] - (int)shear[off]);
+        sum += d;
+        maxDiff = std::max(maxDiff, d);
+    }
+    double mean = direct.is_empty() ? 0 : sum / direct.size();
+    std::cout << angle << ": mean diff " << mean << ", max diff " << maxDiff << std::endl;
+    return mean <= tol;
+}
+
+int main(int argc, char *argv[]) {
+    // test shearcheck <图像> [角度...]：检查三次错切旋转与直接旋转的结果是否一致，不一致时返回1
+    if (argc > 2 && std::string(argv[1]) == "shearcheck") {
+        CImg<unsigned char> a(argv[2]);
+        double defaults[] = {0, 1, 30, 45, 90, 123.4, 180, 269, 300};
+        std::vector<double> angles(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+        if (argc > 3) angles.clear();
+        for (int i = 3; i < argc; i++) angles.push_back(std::atof(argv[i]));
+        bool ok = true;
+        for (int i = 0; i < (int)angles.size(); i++)
+            if (!checkShear(a, angles[i], 2)) ok = false;
+        return ok ? 0 : 1;
+    }
+
+    // test batch <输出目录> [画布数]：从标准输入读入图形参数流，批量生成1024*1024的白底合成图像，
+    // 参数流的格式见readShapes
+    if (argc > 2 && std::string(argv[1]) == "batch") {
+        SaveSynth sink;
+        sink.outpath = argv[2];
+        int canvases = argc > 3 ? std::atoi(argv[3]) : 16;
+        if (canvases < 1) {
+            std::cerr << "bad canvas count: " << argv[3] << std::endl;
+            return 1;
+        }
+        CanvasPool pool(canvases, 1024, 1024, 1, 255);
+        try {
+            std::cout << renderBatch(std::cin, pool, sink) << " images\n";
+        } catch (CImgException &) {
+            // 错误信息已由CImg输出
+            return 1;
+        }
+        return 0;
+    }
+
+    // test manifest <清单文件> [shard <k>/<n>] [skipdone]：按TSV清单批量旋转、缩放，清单格式见readManifest
+    // 列input为输入图像，outdir为输出目录，angle、scale为旋转角度与缩放倍数(默认0与1)，rotate见transformImage，
+    // id为输出文件名中的序号(默认为该项在清单中的序号)，outputs见transformImage
+    // shard k/n只处理序号除以n余k的项，skipdone跳过输出文件都已存在的项
+    if (argc > 2 && std::string(argv[1]) == "manifest") {
+        int shard = 0, shards = 1;
+        bool skipDone = false;
+        for (int i = 3; i < argc; i++) {
+            std::string opt = argv[i];
+            if (opt == "shard" && i + 1 < argc && !parseShard(argv[++i], shard, shards)) {
+                std::cerr << "bad shard: " << argv[i] << std::endl;
+                return 1;
+            }
+            if (opt == "skipdone") skipDone = true;
+        }
+        std::ifstream in(argv[2]);
+        if (!in) {
+            std::cerr << "cannot open manifest: " << argv[2] << std::endl;
+            return 1;
+        }
+        std::vector<ManifestItem> items;
+        readManifest(in, items);
+        int failed = 0;
+        for (int i = shard; i < (int)items.size(); i += shards) {
+            ManifestItem const &item = items[i];
+            char buffer[30];
+            std::sprintf(buffer, "%d", i + 1);
+            std::string id = item.get("id", buffer), outpath = item.get("outdir");
+            if (skipDone) {
+                // 一个输出都不要求的项不算已完成
+                bool done = false;
+                char const *kinds[3] = {"rotate", "resize", "rotresize"};
+                for (int k = 0; k < 3; k++) {
+                    if (!item.wants(kinds[k])) continue;
+                    done = fileExists(joinPath(outpath, kinds[k] + id + ".bmp"));
+                    if (!done) break;
+                }
+                if (done) {
+                    std::cout << "skip " << item.get("input") << std::endl;
+                    continue;
+                }
+            }
+            // 一项失败时跳过该项继续处理其余各项，错误信息已由CImg输出，结束时返回1
+            try {
+                transformImage(item.get("input"), item.getNumber("angle", 0), item.getNumber("scale", 1), outpath, id, item);
+            } catch (CImgException &) {
+                failed++;
+                std::cerr << item.get("input") << ": failed, skipped" << std::endl;
+            }
+        }
+        if (failed) {
+            std::cerr << failed << " item(s) failed" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
     unsigned int n = 0;
     std::string outpath;
     char buffer[30];
@@ -18,23 +163,13 @@ int main() {
     std::cin >> outpath;
     for(int i = 0; i < n; i++) {
         std::string fname;
-        std::cin >> fname;
-        CImg<unsigned char> a(fname.c_str());
-
-        double angle = 0;
-        std::cin >> angle;
-        std::string outname = outpath + "\\rotate" + itoa(i + 1, buffer, 10) + ".bmp";
-        myrotate(a, angle).save(outname.c_str());
-        // a.get_rotate(angle).save(outname.c_str());
-
-        double size = 1;
-        std::cin >> size;
-        outname = outpath + "\\resize" + itoa(i + 1, buffer, 10) + ".bmp";
-        myresize(a, size).save(outname.c_str());
-        // a.get_resize(a.width() * size, a.height() * size).save("output\\CImgResize.bmp");
+        double angle = 0, size = 1;
+        std::cin >> fname >> angle >> size;
+        std::sprintf(buffer, "%d", i + 1);
+        transformImage(fname, angle, size, outpath, buffer, ManifestItem());
     }
 
-    CImg<unsigned char> b("dataset\\blank.bmp");
+    CImg<unsigned char> b("dataset/blank.bmp");
 
     point p1, p2, p3;
     unsigned int bound, r;
@@ -52,6 +187,6 @@ int main() {
     std::cin >> p1.x >> p1.y >> r >> bound;
     drawcicle(b, p1, r, bound);
 
-    b.save((outpath + "\\draw.bmp").c_str());
+    b.save(joinPath(outpath, "draw.bmp").c_str());
     return 0;
 }
@@ -27,14 +27,26 @@ const unsigned char Blue[3] = {0, 0, 255};
 const unsigned char mid[1] = {128};
 
 int main() {
+    // 未定义cimg_use_jpeg时仍由CImg通过ImageMagick读入
     cimg::imagemagick_path("D:\\Program Files\\ImageMagick-6.9.3-Q16\\convert.exe");
     int n;
     string name;
     cin >> n;
-    while(n--) {
+    // 先读入所有文件名，处理当前图像时由后台线程预读下一幅
+    vector<string> names(n);
+    for (int i = 0; i < n; i++) cin >> names[i];
+    PrefetchLoader loader(names, 2);
+    CImg<unsigned char> rimg;
+    string error;
+    for (;;) {
         calTimeCost();
-        cin >> name;
-        CImg<unsigned char> rimg(name.c_str());
+        if (!loader.next(rimg, name, error)) break;
+        if (!error.empty()) {
+            // 错误信息已由CImg输出，跳过该图像
+            cerr << name << ": load failed, skipped" << endl;
+            continue;
+        }
+        cout << "load cost:" << calTimeCost() << endl;
 
         // 定义变量，img的长宽缩小为原图的50%
         // rho, theat为极坐标系下的参数
@@ -57,17 +69,12 @@ int main() {
         getPointFromLines(lines, draw, point(imgw, imgh));
         cout << "getPoint cost:" << calTimeCost() << endl;
         
-        // 在原图上画出求得的矩形
-        for (int i = 0; i < draw.size(); i++) {
-            int x0 = draw[i].first.x * 2,
-                y0 = draw[i].first.y * 2,
-                x1 = draw[i].second.x * 2,
-                y1 = draw[i].second.y * 2;
-            for (int k = -5; k <= 5; k++)
-                rimg.draw_line(x0 + k, y0, x1 + k, y1, Blue);
-            for (int k = -5; k <= 5; k++)
-                rimg.draw_line(x0, y0 + k, x1, y1 + k, Blue);
-        }
+        // 在原图上画出求得的矩形，每条边为宽11像素的抗锯齿线段，记录后一次画出
+        DisplayList<unsigned char> overlay(rimg.spectrum());
+        for (int i = 0; i < (int)draw.size(); i++)
+            overlay.smoothLine(point(draw[i].first.x * 2, draw[i].first.y * 2),
+                               point(draw[i].second.x * 2, draw[i].second.y * 2), 11, Blue);
+        overlay.render(rimg);
         cout << "draw cost:" << calTimeCost() << endl;
 
         rimg.save(name.insert(name.rfind("."), "_draw").c_str());
@@ -3,7 +3,10 @@
 #include <algorithm>
 #include <list>
 #include <vector>
-#include <ctime>
+#include <string>
+#if cimg_OS != 2
+#include <pthread.h>
+#endif
 
 using namespace cimg_library;
 using namespace std;
@@ -21,13 +24,221 @@ typedef struct Point {
     }
 } point;
 
+// 返回距上次调用经过的秒数，按实际经过的时间计算，不用clock()统计的进程CPU时间，
+// 后者会把预读线程占用的时间也算进来
 double calTimeCost() {
-    static clock_t start = clock();
-    double re = ((double)clock() - start) / CLOCKS_PER_SEC;
-    start = clock();
+    static unsigned long start = cimg::time();
+    unsigned long now = cimg::time();
+    double re = (now - start) / 1000.0;
+    start = now;
     return re;
 }
 
+#ifdef cimg_use_jpeg
+// 用libjpeg在进程内解码JPEG文件，逐行解码后写入img的各通道
+void loadJpeg(const char *filename, CImg<unsigned char> &img) {
+    typedef CImg<unsigned char> Img;
+    struct jpeg_decompress_struct cinfo;
+    Img::_cimg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr.original);
+    jerr.original.error_exit = Img::_cimg_jpeg_error_exit;
+    std::FILE *file = cimg::fopen(filename, "rb");
+    vector<unsigned char> row;
+    if (setjmp(jerr.setjmp_buffer)) {
+        cimg::fclose(file);
+        throw CImgIOException("loadJpeg(): Error message returned by libjpeg: %s.", jerr.message);
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, file);
+    jpeg_read_header(&cinfo, TRUE);
+    jpeg_start_decompress(&cinfo);
+    int w = cinfo.output_width, c = cinfo.output_components;
+    img.assign(w, cinfo.output_height, 1, c);
+    row.resize(w * c);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        int y = cinfo.output_scanline;
+        // 灰度图直接解码到img的行中，否则先解码到一行的交错缓冲区再拆分到各通道
+        JSAMPROW ptr = c == 1 ? img.data(0, y) : &row[0];
+        if (jpeg_read_scanlines(&cinfo, &ptr, 1) != 1) break;
+        if (c == 1) continue;
+        for (int v = 0; v < c; v++) {
+            unsigned char *d = img.data(0, y, 0, v);
+            const unsigned char *s = &row[v];
+            for (int x = 0; x < w; x++, s += c) d[x] = *s;
+        }
+    }
+    if (cinfo.output_scanline == cinfo.output_height) jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    cimg::fclose(file);
+}
+#endif
+
+// 读入图像文件到img中
+// 定义cimg_use_jpeg并链接libjpeg时，JPEG文件由loadJpeg在进程内解码，
+// 不再由CImg启动ImageMagick的convert转换为临时文件后读回；其余情况交给CImg的load
+void loadImage(const char *filename, CImg<unsigned char> &img) {
+#ifdef cimg_use_jpeg
+    const char *ext = cimg::split_filename(filename);
+    if (!cimg::strcasecmp(ext, "jpg") || !cimg::strcasecmp(ext, "jpeg")) {
+        loadJpeg(filename, img);
+        return;
+    }
+#endif
+    img.load(filename);
+}
+
+// 互斥量、条件变量与线程的简单封装，Windows下使用Win32 API(条件变量需要Vista及以上，即_WIN32_WINNT >= 0x0600)，
+// 其余系统使用pthread
+#if cimg_OS == 2
+struct Mutex {
+    CRITICAL_SECTION cs;
+    Mutex() { InitializeCriticalSection(&cs); }
+    ~Mutex() { DeleteCriticalSection(&cs); }
+    void lock() { EnterCriticalSection(&cs); }
+    void unlock() { LeaveCriticalSection(&cs); }
+};
+
+struct CondVar {
+    CONDITION_VARIABLE cv;
+    CondVar() { InitializeConditionVariable(&cv); }
+    void wait(Mutex &m) { SleepConditionVariableCS(&cv, &m.cs, INFINITE); }
+    void broadcast() { WakeAllConditionVariable(&cv); }
+};
+
+struct Thread {
+    void (*f)(void *);
+    void *arg;
+    HANDLE handle;
+    static DWORD WINAPI entry(LPVOID self) {
+        ((Thread *)self)->f(((Thread *)self)->arg);
+        return 0;
+    }
+    void start(void (*func)(void *), void *a) {
+        f = func;
+        arg = a;
+        handle = CreateThread(0, 0, entry, this, 0, 0);
+    }
+    void join() {
+        WaitForSingleObject(handle, INFINITE);
+        CloseHandle(handle);
+    }
+};
+#else
+struct Mutex {
+    pthread_mutex_t m;
+    Mutex() { pthread_mutex_init(&m, 0); }
+    ~Mutex() { pthread_mutex_destroy(&m); }
+    void lock() { pthread_mutex_lock(&m); }
+    void unlock() { pthread_mutex_unlock(&m); }
+};
+
+struct CondVar {
+    pthread_cond_t cv;
+    CondVar() { pthread_cond_init(&cv, 0); }
+    ~CondVar() { pthread_cond_destroy(&cv); }
+    void wait(Mutex &m) { pthread_cond_wait(&cv, &m.m); }
+    void broadcast() { pthread_cond_broadcast(&cv); }
+};
+
+struct Thread {
+    void (*f)(void *);
+    void *arg;
+    pthread_t handle;
+    static void *entry(void *self) {
+        ((Thread *)self)->f(((Thread *)self)->arg);
+        return 0;
+    }
+    void start(void (*func)(void *), void *a) {
+        f = func;
+        arg = a;
+        pthread_create(&handle, 0, entry, this);
+    }
+    void join() { pthread_join(handle, 0); }
+};
+#endif
+
+// 后台预读图像：一个线程按names的顺序读入图像，next按原顺序依次取出
+// 已读入而未取出的图像最多depth幅(至少为1)，达到上限时读入线程等待
+// 读入失败时next返回的error为错误信息，img为空，否则error为空
+struct PrefetchLoader {
+    PrefetchLoader(vector<string> const &names, int depth)
+        : names(names), slots(names.size()), depth(std::max(depth, 1)), issued(0), consumed(0), stopping(false) {
+        worker.start(work, this);
+    }
+
+    ~PrefetchLoader() {
+        mutex.lock();
+        stopping = true;
+        changed.broadcast();
+        mutex.unlock();
+        worker.join();
+    }
+
+    // 取出下一幅图像放入img中，name为其文件名，全部取完时返回false
+    bool next(CImg<unsigned char> &img, string &name, string &error) {
+        if (consumed == (int)names.size()) return false;
+        mutex.lock();
+        Slot &s = slots[consumed];
+        while (!s.ready) changed.wait(mutex);
+        img.swap(s.img);
+        s.img.assign();
+        error = s.error;
+        name = names[consumed++];
+        changed.broadcast();
+        mutex.unlock();
+        return true;
+    }
+
+private:
+    struct Slot {
+        CImg<unsigned char> img;
+        string error;
+        bool ready;
+        Slot() : ready(false) {}
+    };
+
+    vector<string> names;
+    vector<Slot> slots;
+    int depth;
+    int issued, consumed;           // 已开始读入的个数与已取出的个数
+    bool stopping;
+    Mutex mutex;
+    CondVar changed;
+    Thread worker;
+
+    // 读入线程：在深度允许时读入下一个文件，读入后放入对应的位置
+    static void work(void *self) {
+        PrefetchLoader &p = *(PrefetchLoader *)self;
+        p.mutex.lock();
+        while (!p.stopping && p.issued < (int)p.names.size()) {
+            if (p.issued - p.consumed >= p.depth) {
+                p.changed.wait(p.mutex);
+                continue;
+            }
+            int i = p.issued++;
+            p.mutex.unlock();
+
+            // 错误信息已由CImg输出，这里只记录下来交给next
+            CImg<unsigned char> img;
+            string error;
+            try {
+                loadImage(p.names[i].c_str(), img);
+            } catch (CImgException &e) {
+                error = e.what();
+            }
+
+            p.mutex.lock();
+            Slot &s = p.slots[i];
+            img.swap(s.img);
+            s.error = error;
+            s.ready = true;
+            p.changed.broadcast();
+        }
+        p.mutex.unlock();
+    }
+};
+
 // 判断两以theta1 2的直线是否平行
 bool parallel(double const &theta1, double const &theta2) {
     double diff = fabs(theta1 - theta2);
@@ -319,6 +530,244 @@ double dist(point p0, point p1) {
     return std::sqrt(std::pow(p0.y - p1.y, 2) + std::pow(p0.x - p1.x, 2));
 }
 
+// 将第y行[xs, xe]内的像素置为color，color[v]为第v个通道的值，区间先截断到图像内
+template <typename T>
+void fillSpan(CImg<T>& img, int y, int xs, int xe, T const *color) {
+    if (y < 0 || y >= img.height()) return;
+    xs = std::max(xs, 0);
+    xe = std::min(xe, img.width() - 1);
+    if (xs > xe) return;
+    cimg_forC(img, v) std::fill(img.data(xs, y, 0, v), img.data(xe, y, 0, v) + 1, color[v]);
+}
+
+// 图像中x0 <= x <= x1、y0 <= y <= y1的矩形区域，用于把绘制限制在图像的一块内
+struct ClipRect {
+    int x0, y0, x1, y1;
+    ClipRect(int x0, int y0, int x1, int y1) : x0(x0), y0(y0), x1(x1), y1(y1) {}
+    template <typename T>
+    ClipRect(CImg<T> const &img) : x0(0), y0(0), x1(img.width() - 1), y1(img.height() - 1) {}
+};
+
+// 凸多边形P[0]...P[n - 1]的走向，逆时针(y轴向下时为顺时针)为1，反之为-1，退化为线段或点时为0
+double polygonOrientation(point const *P, int n) {
+    double area = 0;
+    for (int i = 0; i < n; i++) area += P[i].x * P[(i + 1) % n].y - P[(i + 1) % n].x * P[i].y;
+    return fabs(area) < EPS ? 0 : (area > 0 ? 1 : -1);
+}
+
+// 将[lo, hi]缩小为与凸多边形P在第y行上的区间的交集，s为P的走向，返回false表示交集为空
+// 每条边所在的半平面在一行内是对x的一个线性约束，内侧满足s * ((b - a) x (p - a)) >= 0，整理为A * x + B >= 0
+bool convexSpan(point const *P, int n, double s, double y, double &lo, double &hi) {
+    for (int i = 0; i < n; i++) {
+        point const &a = P[i], &b = P[(i + 1) % n];
+        double A = -s * (b.y - a.y), B = s * ((b.x - a.x) * (y - a.y) + (b.y - a.y) * a.x);
+        if (fabs(A) < 1e-12) {
+            if (B < 0) return false;
+        } else if (A > 0) {
+            lo = std::max(lo, -B / A);
+        } else {
+            hi = std::min(hi, -B / A);
+        }
+    }
+    return lo <= hi;
+}
+
+// 扫描转换凸多边形P[0]...P[n - 1]，填充像素中心落在多边形内的像素
+// 逐行由convexSpan求出填充区间，只访问多边形包围盒与clip相交部分内的行
+template <typename T>
+void fillConvexPolygon(CImg<T>& img, point const *P, int n, T const *color, ClipRect const &clip) {
+    double s = polygonOrientation(P, n), ymin = P[0].y, ymax = P[0].y;
+    if (s == 0) return;
+    for (int i = 1; i < n; i++) {
+        ymin = std::min(ymin, P[i].y);
+        ymax = std::max(ymax, P[i].y);
+    }
+
+    int ys = std::max(clip.y0, (int)std::ceil(ymin)), ye = std::min(clip.y1, (int)std::floor(ymax));
+    for (int y = ys; y <= ye; y++) {
+        double lo = clip.x0, hi = clip.x1;
+        if (convexSpan(P, n, s, y, lo, hi)) fillSpan(img, y, (int)std::ceil(lo), (int)std::floor(hi), color);
+    }
+}
+
+template <typename T>
+void fillConvexPolygon(CImg<T>& img, point const *P, int n, T color) {
+    std::vector<T> c(img.spectrum(), color);
+    fillConvexPolygon(img, P, n, &c[0], ClipRect(img));
+}
+
+// p1、p2间宽为width的线段所占的矩形，以线段为中轴、两端各延长width / 2，四个角点写入Q
+void thickLineQuad(point p1, point p2, double width, point *Q) {
+    double d = dist(p1, p2), hw = width / 2;
+    // 沿线段方向的半宽向量(ux, uy)及其法向(-uy, ux)
+    double ux = d < EPS ? hw : (p2.x - p1.x) / d * hw, uy = d < EPS ? 0 : (p2.y - p1.y) / d * hw;
+    Q[0] = point(p1.x - ux - uy, p1.y - uy + ux);
+    Q[1] = point(p2.x + ux - uy, p2.y + uy + ux);
+    Q[2] = point(p2.x + ux + uy, p2.y + uy - ux);
+    Q[3] = point(p1.x - ux + uy, p1.y - uy - ux);
+}
+
+// 画出p1、p2间宽为width的线段
+template <typename T>
+void drawThickLine(CImg<T>& img, point p1, point p2, double width, T const *color, ClipRect const &clip) {
+    point Q[4];
+    thickLineQuad(p1, p2, width, Q);
+    fillConvexPolygon(img, Q, 4, color, clip);
+}
+
+template <typename T>
+void drawThickLine(CImg<T>& img, point p1, point p2, double width, T color) {
+    std::vector<T> c(img.spectrum(), color);
+    drawThickLine(img, p1, p2, width, &c[0], ClipRect(img));
+}
+
+// 将插值结果写入像素，整数类型需四舍五入并截断到取值范围内
+inline void storePixel(float &d, double v) { d = (float)v; }
+inline void storePixel(double &d, double v) { d = v; }
+inline void storePixel(unsigned char &d, double v) {
+    d = (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v + 0.5));
+}
+inline void storePixel(unsigned short &d, double v) {
+    d = (unsigned short)(v < 0 ? 0 : (v > 65535 ? 65535 : v + 0.5));
+}
+
+// 画出p1、p2间宽为width的抗锯齿线段，线段两端为半圆
+// 像素到线段的距离减去width / 2即为到线段边界的有向距离sd，像素的覆盖率取0.5 - sd并截断到[0, 1]，
+// 按覆盖率乘以opacity与原像素混合；只访问外扩半个像素的线段所在矩形内的像素，每个像素只写一次
+template <typename T>
+void drawSmoothLine(CImg<T>& img, point p1, point p2, double width, T const *color, ClipRect const &clip,
+                    double opacity = 1) {
+    double hw = width / 2, dx = p2.x - p1.x, dy = p2.y - p1.y, len2 = dx * dx + dy * dy;
+    double inner = hw > 0.5 ? (hw - 0.5) * (hw - 0.5) : -1, outer = (hw + 0.5) * (hw + 0.5);
+    point Q[4];
+    thickLineQuad(p1, p2, width + 1, Q);
+    double s = polygonOrientation(Q, 4);
+    int ys = std::max(clip.y0, (int)std::ceil(std::min(std::min(Q[0].y, Q[1].y), std::min(Q[2].y, Q[3].y)))),
+        ye = std::min(clip.y1, (int)std::floor(std::max(std::max(Q[0].y, Q[1].y), std::max(Q[2].y, Q[3].y))));
+    for (int y = ys; y <= ye; y++) {
+        double lo = clip.x0, hi = clip.x1;
+        if (!convexSpan(Q, 4, s, y, lo, hi)) continue;
+        int xs = std::max((int)std::ceil(lo), 0), xe = std::min((int)std::floor(hi), img.width() - 1);
+        for (int x = xs; x <= xe; x++) {
+            // 到线段的距离的平方，t为垂足在线段上的位置
+            double px = x - p1.x, py = y - p1.y;
+            double t = len2 < EPS ? 0 : std::max(0.0, std::min(1.0, (px * dx + py * dy) / len2));
+            double ex = px - t * dx, ey = py - t * dy, d2 = ex * ex + ey * ey;
+            if (d2 >= outer) continue;
+            double a = d2 <= inner ? opacity : std::min(1.0, hw + 0.5 - std::sqrt(d2)) * opacity;
+            cimg_forC(img, v) {
+                T &p = img(x, y, 0, v);
+                storePixel(p, p + (color[v] - (double)p) * a);
+            }
+        }
+    }
+}
+
+template <typename T>
+void drawSmoothLine(CImg<T>& img, point p1, point p2, double width, T color, double opacity = 1) {
+    std::vector<T> c(img.spectrum(), color);
+    drawSmoothLine(img, p1, p2, width, &c[0], ClipRect(img), opacity);
+}
+
+// 绘制命令列表，先记录所有线段、凸多边形和抗锯齿线段，最后由render一次画到图像上
+// render把图像分为tile*tile的块，将每个图形登记到其包围盒覆盖的块中，再逐块只画登记在该块中的图形，
+// 每块只被访问一次，块之间互不重叠，可以并行；同一块内按记录的顺序绘制，后记录的图形在上层
+// 颜色为spectrum个通道的值，应与render的图像的通道数一致
+template <typename T>
+struct DisplayList {
+    enum ShapeType { POLYGON, SMOOTH_LINE };
+    struct Shape {
+        ShapeType type;
+        int first, count;           // 多边形的顶点为pts[first]...pts[first + count - 1]，抗锯齿线段的两端点同样存放
+        double width;               // 抗锯齿线段的宽度
+        int color;                  // 颜色为colors[color]...colors[color + spectrum - 1]
+        double x0, y0, x1, y1;      // 包围盒
+    };
+
+    int spectrum;
+    vector<Shape> shapes;
+    vector<point> pts;
+    vector<T> colors;
+
+    DisplayList(int spectrum) : spectrum(spectrum) {}
+
+    void clear() {
+        shapes.clear();
+        pts.clear();
+        colors.clear();
+    }
+
+    void polygon(point const *P, int n, T const *color) {
+        Shape s;
+        s.type = POLYGON;
+        s.first = pts.size();
+        s.count = n;
+        s.x0 = s.x1 = P[0].x;
+        s.y0 = s.y1 = P[0].y;
+        for (int i = 0; i < n; i++) {
+            pts.push_back(P[i]);
+            s.x0 = std::min(s.x0, P[i].x); s.x1 = std::max(s.x1, P[i].x);
+            s.y0 = std::min(s.y0, P[i].y); s.y1 = std::max(s.y1, P[i].y);
+        }
+        add(s, color);
+    }
+
+    void line(point p1, point p2, double width, T const *color) {
+        point Q[4];
+        thickLineQuad(p1, p2, width, Q);
+        polygon(Q, 4, color);
+    }
+
+    void smoothLine(point p1, point p2, double width, T const *color) {
+        Shape s;
+        s.type = SMOOTH_LINE;
+        s.first = pts.size();
+        s.count = 2;
+        s.width = width;
+        pts.push_back(p1);
+        pts.push_back(p2);
+        double ext = width / 2 + 1;
+        s.x0 = std::min(p1.x, p2.x) - ext; s.x1 = std::max(p1.x, p2.x) + ext;
+        s.y0 = std::min(p1.y, p2.y) - ext; s.y1 = std::max(p1.y, p2.y) + ext;
+        add(s, color);
+    }
+
+    void render(CImg<T> &img, int tile = 64) const {
+        int tw = (img.width() + tile - 1) / tile, th = (img.height() + tile - 1) / tile;
+        vector< vector<int> > bins(tw * th);
+        for (int i = 0; i < (int)shapes.size(); i++) {
+            Shape const &s = shapes[i];
+            if (s.x1 < 0 || s.y1 < 0 || s.x0 > img.width() - 1 || s.y0 > img.height() - 1) continue;
+            int tx0 = std::max(0, (int)s.x0 / tile), tx1 = std::min(tw - 1, (int)s.x1 / tile),
+                ty0 = std::max(0, (int)s.y0 / tile), ty1 = std::min(th - 1, (int)s.y1 / tile);
+            for (int ty = ty0; ty <= ty1; ty++)
+                for (int tx = tx0; tx <= tx1; tx++) bins[ty * tw + tx].push_back(i);
+        }
+
+#ifdef cimg_use_openmp
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int b = 0; b < tw * th; b++) {
+            if (bins[b].empty()) continue;
+            int tx = b % tw, ty = b / tw;
+            ClipRect clip(tx * tile, ty * tile, std::min(img.width(), (tx + 1) * tile) - 1,
+                          std::min(img.height(), (ty + 1) * tile) - 1);
+            for (int k = 0; k < (int)bins[b].size(); k++) {
+                Shape const &s = shapes[bins[b][k]];
+                if (s.type == POLYGON) fillConvexPolygon(img, &pts[s.first], s.count, &colors[s.color], clip);
+                else drawSmoothLine(img, pts[s.first], pts[s.first + 1], s.width, &colors[s.color], clip);
+            }
+        }
+    }
+
+private:
+    void add(Shape &s, T const *color) {
+        s.color = colors.size();
+        colors.insert(colors.end(), color, color + spectrum);
+        shapes.push_back(s);
+    }
+};
+
 // 画出由p1 p2 p3三点确定的矩形（平行四边形），若不是矩形会有提示，bound为边宽
 void drawrectangle(CImg<unsigned char>& img, point p1, point p2, point p3, unsigned int bound) {
     double d12 = dist(p1, p2), d13 = dist(p1, p3), d23 = dist(p2, p3);
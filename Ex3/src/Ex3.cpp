@@ -19,37 +19,359 @@
 
 #include "CImg.h"
 #include "myImg.h"
+#if cimg_OS == 2
+#include <direct.h>
+#endif
 
 using namespace cimg_library;
 using namespace std;
 
-unsigned char Blue[3] = {0, 0, 63};
+const unsigned char Blue[3] = {0, 0, 63};
 unsigned char mid[1] = {128};
 
-int main() {
+// 一幅图像的处理任务，由批处理清单中的一项或标准输入中的一个文件名得到
+struct Job {
+    string input;                   // 输入图像
+    string vote, draw, a4, svg;     // 各输出的文件名，为空时不生成
+    ResolutionPolicy policy;
+    double policyValue;
+};
+
+// 由清单中的一项生成任务，未指定的列取defaults中的值，defaults由命令行参数得到
+// 输出文件名与原来一致，指定outdir时放在该目录下
+Job makeJob(ManifestItem item, ManifestItem const &defaults) {
+    // 只指定了policy时value取该策略的默认值，而不是命令行中其他策略的参数
+    if (!item.get("policy").empty() && item.get("value").empty())
+        item.cols["value"] = item.get("policy") == "mp" ? "2" : "254";
+    item.cols.insert(defaults.cols.begin(), defaults.cols.end());
+
+    Job job;
+    job.input = item.get("input");
+    string dir = item.get("outdir");
+    string out = dir.empty() ? job.input : joinPath(dir, baseName(job.input));
+    string::size_type dot = out.rfind('.'), slash = out.find_last_of("/\\");
+    if (dot == string::npos || (slash != string::npos && dot < slash)) dot = out.size();
+    string draw = string(out).insert(dot, "_draw");
+    if (item.wants("vote")) job.vote = out + "_vote.bmp";
+    if (item.wants("draw")) job.draw = draw;
+    if (item.wants("a4")) job.a4 = draw + "_a4.jpg";
+    if (item.wants("svg")) job.svg = out + "_draw.svg";
+
+    string mode = item.get("policy");
+    job.policy = mode == "source" ? MATCH_SOURCE : mode == "mp" ? MAX_MEGAPIXELS : TARGET_DPI;
+    job.policyValue = item.getNumber("value", 254);
+    return job;
+}
+
+// 任务的输出文件是否都已存在，用于skipdone；一个输出文件都不生成的任务(如outputs none)不算已完成
+bool jobDone(Job const &job) {
+    string const *outs[4] = { &job.vote, &job.draw, &job.a4, &job.svg };
+    bool any = false;
+    for (int i = 0; i < 4; i++) {
+        if (outs[i]->empty()) continue;
+        if (!fileExists(*outs[i])) return false;
+        any = true;
+    }
+    return any;
+}
+
+// 将路径分为各级名称，相对路径先接在当前目录之后，并去掉其中的"."与".."
+vector<string> pathComponents(string path) {
+    replace(path.begin(), path.end(), '\\', '/');
+    if (path.empty() || (path[0] != '/' && (path.size() < 2 || path[1] != ':'))) {
+        char buf[4096];
+#if cimg_OS == 2
+        if (_getcwd(buf, sizeof(buf))) path = string(buf) + "/" + path;
+#else
+        if (getcwd(buf, sizeof(buf))) path = string(buf) + "/" + path;
+#endif
+        replace(path.begin(), path.end(), '\\', '/');
+    }
+    vector<string> parts;
+    for (string::size_type s = 0, e; s <= path.size(); s = e + 1) {
+        e = path.find('/', s);
+        if (e == string::npos) e = path.size();
+        string part = path.substr(s, e - s);
+        if (part == "..") {
+            if (parts.size() > 1) parts.pop_back();
+        } else if (!part.empty() && part != ".") {
+            parts.push_back(part);
+        }
+    }
+    return parts;
+}
+
+// 从目录dir到文件target的相对路径，供SVG覆盖层引用原图，两者不在同一盘符下时返回target的绝对路径
+string relativePath(string const &target, string const &dir) {
+    vector<string> t = pathComponents(target), d = pathComponents(dir);
+    int n = 0;
+    while (n < (int)d.size() && n + 1 < (int)t.size() && t[n] == d[n]) n++;
+    string re;
+    if (n == 0 && !t.empty() && !d.empty() && t[0].find(':') != string::npos) {
+        re = t[0];
+        for (int i = 1; i < (int)t.size(); i++) re += "/" + t[i];
+        return re;
+    }
+    for (int i = n; i < (int)d.size(); i++) re += "../";
+    for (int i = n; i < (int)t.size(); i++) re += (i > n ? "/" : "") + t[i];
+    return re;
+}
+
+// 文件名中最后一个'/'或'\'之前的部分，没有时为空，即当前目录
+string dirName(string const &path) {
+    string::size_type p = path.find_last_of("/\\");
+    return p == string::npos ? "" : path.substr(0, p);
+}
+
+// 监视目录或帧目录中的文件name是否作为输入：只处理图像文件，并跳过本程序输出到同一目录中的结果
+bool isInputImage(string const &name) {
+    string ext = cimg::split_filename(name.c_str());
+    for (int i = 0; i < (int)ext.size(); i++) ext[i] = tolower(ext[i]);
+    if (ext != "jpg" && ext != "jpeg" && ext != "png" && ext != "bmp") return false;
+    string base = baseName(name);
+    return base.find("_draw.") == string::npos &&
+           (base.size() < 9 || base.compare(base.size() - 9, 9, "_vote.bmp") != 0);
+}
+
+// 按自然顺序比较文件名，其中的数字按数值比较，使frame9排在frame10之前
+bool naturalLess(string const &a, string const &b) {
+    string::size_type i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (isdigit((unsigned char)a[i]) && isdigit((unsigned char)b[j])) {
+            string::size_type ei = i, ej = j;
+            while (ei < a.size() && isdigit((unsigned char)a[ei])) ei++;
+            while (ej < b.size() && isdigit((unsigned char)b[ej])) ej++;
+            double x = atof(a.substr(i, ei - i).c_str()), y = atof(b.substr(j, ej - j).c_str());
+            if (x != y) return x < y;
+            i = ei;
+            j = ej;
+        } else {
+            if (a[i] != b[j]) return a[i] < b[j];
+            i++;
+            j++;
+        }
+    }
+    return a.size() - i < b.size() - j;
+}
+
+// 视频video中第k帧的名称，用于生成该帧各输出的文件名，如capture.mp4的第12帧为capture_000012.jpg
+string frameName(string const &video, int k) {
+    string::size_type dot = video.rfind('.'), slash = video.find_last_of("/\\");
+    if (dot == string::npos || (slash != string::npos && dot < slash)) dot = video.size();
+    char buffer[16];
+    sprintf(buffer, "_%06d.jpg", k);
+    return video.substr(0, dot) + buffer;
+}
+
+// 监视线程：把目录中新写完的图像依次加入loader
+struct WatchFeeder {
+    DirWatcher *watcher;
+    PrefetchLoader *loader;
+
+    static void run(void *self) {
+        WatchFeeder &f = *(WatchFeeder *)self;
+        for (;;) {
+            string name = f.watcher->next();
+            if (isInputImage(name)) f.loader->add(name);
+        }
+    }
+};
+
+// 命令行参数选择输出分辨率策略、预读与写出方式及输入，可任意组合：
+// Ex3 [dpi <DPI> | source | mp <百万像素数>] [prefetch <深度>] [prefetchmb <内存上限MB>]
+//     [writers <线程数>] [writequeue <深度>] [manifest <清单文件>] [shard <k>/<n>] [skipdone]
+//     [watch <目录>] [outdir <输出目录>] [outputs <输出种类>] [detect <结果文件>]
+//     [frames <帧目录>] [video <视频文件>] [videofps <帧率>] [ffmpeg <ffmpeg路径>]
+// 默认为dpi 254，即2970*2100；后台预读2幅，预读图像共占用不超过512MB；2个线程写出，最多4个排队
+// 未指定manifest时从标准输入读入测试个数与各文件名，清单格式见readManifest，各列的含义见README
+// shard k/n只处理序号除以n余k的项，skipdone跳过输出文件都已存在的项
+// watch持续监视目录，每写完一幅新图像即处理，不再退出；outdir为未在清单中指定输出目录时的输出目录
+// outputs为未在清单中指定时的输出种类，如outputs none不输出图像；detect把检测结果写入文件，格式见DetectionLog
+// frames依次处理目录中按编号命名的各帧图像；video通过ffmpeg管道逐帧读入视频，videofps先抽帧为每秒若干帧，
+// 视频默认不输出图像，只把各帧的检测结果写入detect指定的文件
+int main(int argc, char *argv[]) {
+    // 未定义cimg_use_jpeg或cimg_use_png时，CImg通过ImageMagick读入对应格式的图像
     cimg::imagemagick_path("D:\\Program Files\\ImageMagick-6.9.3-Q16\\convert.exe");
-    int n;
-    string name;
-    cin >> n;
-    while(n--) {
+    // 命令行中的输出目录、输出种类及分辨率策略作为清单中各项的默认值
+    ManifestItem defaults;
+    double prefetchMB = 512;
+    int prefetchDepth = 2, writers = 2, writeDepth = 4, shard = 0, shards = 1;
+    string manifest, watch, detect, frames, videoFile, ffmpeg = "ffmpeg";
+    double videoFps = 0;
+    bool skipDone = false;
+    for (int i = 1; i < argc; i++) {
+        string opt = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (opt == "source") {
+            defaults.cols["policy"] = opt;
+        } else if ((opt == "dpi" || opt == "mp") && hasValue) {
+            defaults.cols["policy"] = opt;
+            defaults.cols["value"] = argv[++i];
+        } else if (opt == "prefetch" && hasValue) {
+            prefetchDepth = max(0, atoi(argv[++i]));
+        } else if (opt == "prefetchmb" && hasValue) {
+            prefetchMB = atof(argv[++i]);
+        } else if (opt == "writers" && hasValue) {
+            writers = max(0, atoi(argv[++i]));
+        } else if (opt == "writequeue" && hasValue) {
+            writeDepth = max(1, atoi(argv[++i]));
+        } else if (opt == "manifest" && hasValue) {
+            manifest = argv[++i];
+        } else if (opt == "shard" && hasValue) {
+            if (!parseShard(argv[++i], shard, shards)) {
+                cerr << "bad shard: " << argv[i] << endl;
+                return 1;
+            }
+        } else if (opt == "skipdone") {
+            skipDone = true;
+        } else if (opt == "watch" && hasValue) {
+            watch = argv[++i];
+        } else if ((opt == "outdir" || opt == "outputs") && hasValue) {
+            defaults.cols[opt] = argv[++i];
+        } else if (opt == "detect" && hasValue) {
+            detect = argv[++i];
+        } else if (opt == "frames" && hasValue) {
+            frames = argv[++i];
+        } else if (opt == "video" && hasValue) {
+            videoFile = argv[++i];
+        } else if (opt == "videofps" && hasValue) {
+            videoFps = atof(argv[++i]);
+        } else if (opt == "ffmpeg" && hasValue) {
+            ffmpeg = argv[++i];
+        }
+    }
+
+    vector<ManifestItem> items;
+    if (!watch.empty() || !videoFile.empty()) {
+        // 监视目录与视频没有事先给出的输入
+        if (!videoFile.empty() && defaults.get("outputs").empty()) {
+            defaults.cols["outputs"] = "none";
+            if (detect.empty()) cerr << "no outputs for video, use detect <file> or outputs <kinds>" << endl;
+        }
+    } else if (!frames.empty()) {
+        if (!cimg::is_directory(frames.c_str())) {
+            cerr << "cannot open frame directory: " << frames << endl;
+            return 1;
+        }
+        CImgList<char> files = cimg::files(frames.c_str(), false, 0, false);
+        vector<string> frameFiles;
+        cimglist_for(files, i) if (isInputImage(files[i]._data)) frameFiles.push_back(files[i]._data);
+        sort(frameFiles.begin(), frameFiles.end(), naturalLess);
+        items.resize(frameFiles.size());
+        for (int i = 0; i < (int)frameFiles.size(); i++) items[i].cols["input"] = joinPath(frames, frameFiles[i]);
+    } else if (manifest.empty()) {
+        int n;
+        cin >> n;
+        items.resize(max(n, 0));
+        for (int i = 0; i < (int)items.size(); i++) cin >> items[i].cols["input"];
+    } else {
+        ifstream in(manifest.c_str());
+        if (!in) {
+            cerr << "cannot open manifest: " << manifest << endl;
+            return 1;
+        }
+        readManifest(in, items);
+    }
+
+    vector<Job> jobs;
+    vector<string> names;
+    for (int i = 0; i < (int)items.size(); i++) {
+        if (i % shards != shard) continue;
+        Job job = makeJob(items[i], defaults);
+        if (skipDone && jobDone(job)) {
+            cout << "skip " << job.input << endl;
+            continue;
+        }
+        jobs.push_back(job);
+        names.push_back(job.input);
+    }
+
+    // 检测在长宽缩小为原图50%的灰度图上进行，JPEG文件在解码时直接缩小，原图rimg只在最后映射时读入四边形所在的部分；
+    // 其余格式读入全图，缩小与求模长一起进行，rimg直接从全图中取出
+    // limg由后台线程提前读入，处理当前图像时下一幅已在解码，prefetch 0时改为在循环中依次读入
+    // 各输出图像交给writer在后台编码写出，A4图像的映射也在写出线程中进行，writers 0时改为直接写出
+    // 监视模式下由监视线程不断把新图像加入loader，各缓冲区与线程在各图像间复用
+    // 视频的各帧由ffmpeg在另一进程中解码，依次读入limg，与非JPEG图像一样处理
+    PrefetchLoader loader(names, 2, prefetchDepth, min(prefetchDepth, 4),
+                          (unsigned long)(prefetchMB * 1024 * 1024), !watch.empty());
+    ImageWriter writer(writers, writeDepth);
+    DetectionLog *log = detect.empty() ? 0 : new DetectionLog(detect);
+    DirWatcher *watcher = 0;
+    Thread watchThread;
+    WatchFeeder feeder;
+    if (!watch.empty()) {
+        watcher = new DirWatcher(watch);
+        feeder.watcher = watcher;
+        feeder.loader = &loader;
+        watchThread.start(WatchFeeder::run, &feeder);
+        cout << "watching " << watch << endl;
+    }
+    VideoSource *video = videoFile.empty() ? 0 : new VideoSource(videoFile, videoFps, ffmpeg);
+    CImg<unsigned char> limg, simg, rimg;
+    string file, error;
+    int failed = 0;     // 读入失败而跳过的图像数
+    for (int k = 0; ; k++) {
         calTimeCost();
-        cin >> name;
-        CImg<> rimg(name.c_str());
+        Job job;
+        // limg为读入的图像，已在解码时缩小reduced倍，srcw、srch为原图的大小
+        int reduced = 1, srcw = 0, srch = 0;
+        if (video) {
+            try {
+                if (!video->next(limg)) break;
+            } catch (CImgException &) {
+                // 错误信息已由CImg输出，视频流读入失败后无法再取出后面的帧
+                failed++;
+                break;
+            }
+            file = frameName(videoFile, video->frames - 1);
+            srcw = limg.width();
+            srch = limg.height();
+        } else {
+            if (!loader.next(limg, file, reduced, srcw, srch, error)) break;
+            if (!error.empty()) {
+                // 一幅图像读入失败时跳过该图像继续处理其余图像，已排队的写出不受影响，结束时返回1
+                // 错误信息已由CImg输出
+                failed++;
+                cerr << file << ": load failed, skipped" << endl;
+                continue;
+            }
+        }
+        if (watcher || video) {
+            ManifestItem item;
+            item.cols["input"] = file;
+            job = makeJob(item, defaults);
+            // 视频的帧没有对应的图像文件可供SVG引用
+            if (video) job.svg.clear();
+        } else {
+            job = jobs[k];
+        }
+        cout << "load cost:" << calTimeCost() << endl;
 
-        // 定义变量，img的长宽缩小为原图的50%
+        // 定义变量，img为limg各像素模长缩小为原图的50%并归一化到[0, 255]后的灰度图
         // rho, theat为极坐标系下的参数
-        CImg<> img = rimg.get_norm().normalize(0, 255).resize(-50, -50, 1, 2, 2);
+        CImg<unsigned char> img = normDownsample(limg, 2 / reduced);
         unsigned imgw = img.width(), imgh = img.height();
         double rhomax = sqrt((double)(imgh * imgh + imgw * imgw)) / 2,
                thetamax = 2 * cimg::PI;
 
         // 得到hough投票结果
         CImg<> vote = getVote(img);
+        // getLinesFromVote会修改vote，写出的是其副本
+        if (!job.vote.empty()) {
+            CImg<> voteOut(vote);
+            writer.save(voteOut, job.vote);
+        }
         cout << "Vote cost:" << calTimeCost() << endl;
-        vote.save((name + "_vote.bmp").c_str());
 
-        // 从投票结果得到直线
-        list<point> lines = getLinesFromVote(vote, point(imgw, imgh));
+        // 从投票结果得到直线，getPointFromLines会去掉其中一部分，记录检测结果时先保存下来
+        vector<double> scores;
+        list<point> lines = getLinesFromVote(vote, point(imgw, imgh), &scores);
+        Detection det;
+        det.input = video ? videoFile : job.input;
+        det.frame = video ? video->frames - 1 : -1;
+        det.scores = scores;
+        for (list<point>::iterator it = lines.begin(); it != lines.end(); it++)
+            det.lines.push_back(point(it->x, it->y * 2));
         cout << "getLine cost:" << calTimeCost() << endl;
 
         // 由直线得到角点
@@ -57,47 +379,107 @@ int main() {
         getPointFromLines(lines, pointPair, point(imgw, imgh));
         cout << "getPoint cost:" << calTimeCost() << endl;
         
-        // 在原图上画出求得的矩形
-        for (int i = 0; i < pointPair.size(); i++) {
-            int x0 = pointPair[i].first.x * 2,
-                y0 = pointPair[i].first.y * 2,
-                x1 = pointPair[i].second.x * 2,
-                y1 = pointPair[i].second.y * 2;
-            for (int k = -5; k <= 5; k++)
-                rimg.draw_line(x0 + k, y0, x1 + k, y1, Blue);
-            for (int k = -5; k <= 5; k++)
-                rimg.draw_line(x0, y0 + k, x1, y1 + k, Blue);
-            Blue[3] += 64;
-        }
-        cout << "pointPair cost:" << calTimeCost() << endl;
-
-        rimg.save(name.insert(name.rfind("."), "_draw").c_str());
-        cout << "save cost:" << calTimeCost() << endl;
+        // 在缩小的图上画出求得的矩形，各边先记录下来再一次画出
+        if (!job.draw.empty()) {
+            // 边框画在原图缩小一半的simg上，limg在解码时已缩小的直接拿来画，之后不再需要limg
+            if (reduced == 2) simg.swap(limg);
+            else simg = halfDownsample(limg);
+
+            // 每条边的颜色依次变亮，每幅图都从Blue开始
+            DisplayList<unsigned char> overlay(simg.spectrum());
+            unsigned char color[3] = {Blue[0], Blue[1], Blue[2]};
+            for (int i = 0; i < (int)pointPair.size(); i++) {
+                overlay.smoothLine(pointPair[i].first, pointPair[i].second, 6, color);
+                color[2] += 64;
+            }
+            overlay.render(simg);
+            cout << "pointPair cost:" << calTimeCost() << endl;
+
+            writer.save(simg, job.draw);
+            cout << "save cost:" << calTimeCost() << endl;
+        }
+
+        // 四条边不全时无法矫正，只记录检测结果
+        det.found = pointPair.size() >= 4;
+        if (!det.found) cerr << job.input << ": no quadrangle found" << endl;
+        bool record = log || !job.svg.empty();
+        if (!record && (job.a4.empty() || !det.found)) continue;
 
         // 得到原图中四边形的顶点坐标
-        point *a4p = new point[4], *srcp = new point[4];
-        int l = 0;
-        if (dist(pointPair[0]) < dist(pointPair[1])) l = 1;
-        srcp[0] = point(pointPair[l].first.x * 2,  pointPair[l].first.y * 2);
-        srcp[1] = point(pointPair[l].second.x * 2, pointPair[l].second.y * 2);
-        srcp[2] = point(pointPair[3 - l].first.x * 2,  pointPair[3 - l].first.y * 2);
-        srcp[3] = point(pointPair[3 - l].second.x * 2, pointPair[3 - l].second.y * 2);
-
-        // 对坐标进行排序，准备映射到A4比例的CImg中
-        CImg<> a4;
-        if(arrangePoint(srcp)) a4 = CImg<>(2970, 2100, 1, 3, 0);
-        else a4 = CImg<>(2100, 2970, 1, 3, 0);
-        a4p[0] = point(0, 0);
-        a4p[1] = point(a4.width() - 1, 0);
-        a4p[2] = point(a4.width() - 1, a4.height() - 1);
-        a4p[3] = point(0, a4.height() - 1);
+        point a4p[4], srcp[4];
+        int a4w = 0, a4h = 0;
+        if (det.found) {
+            int l = 0;
+            if (dist(pointPair[0]) < dist(pointPair[1])) l = 1;
+            srcp[0] = point(pointPair[l].first.x * 2,  pointPair[l].first.y * 2);
+            srcp[1] = point(pointPair[l].second.x * 2, pointPair[l].second.y * 2);
+            srcp[2] = point(pointPair[3 - l].first.x * 2,  pointPair[3 - l].first.y * 2);
+            srcp[3] = point(pointPair[3 - l].second.x * 2, pointPair[3 - l].second.y * 2);
+
+            // 对坐标进行排序，准备映射到A4比例的图像中
+            getOutputSize(srcp, arrangePoint(srcp), job.policy, job.policyValue, a4w, a4h);
+            a4p[0] = point(0, 0);
+            a4p[1] = point(a4w - 1, 0);
+            a4p[2] = point(a4w - 1, a4h - 1);
+            a4p[3] = point(0, a4h - 1);
+        }
         cout << "cal point cost:" << calTimeCost() << endl;
 
-        // 将原图中的四边形投影映射到A4中
-        projectiveMapping(rimg, a4, srcp, a4p);
-        cout << "projective mapping cost:" << calTimeCost() << endl;
+        if (record) {
+            for (int i = 0; i < (int)pointPair.size(); i++) {
+                point e[2] = { pointPair[i].first, pointPair[i].second };
+                for (int j = 0; j < 2; j++) {
+                    point c(e[j].x * 2, e[j].y * 2);
+                    if (find(det.corners.begin(), det.corners.end(), c) == det.corners.end()) det.corners.push_back(c);
+                }
+            }
+            copy(srcp, srcp + 4, det.quad);
+            det.outw = a4w;
+            det.outh = a4h;
+            if (log) log->write(det);
+            // 覆盖层与原图一样大
+            if (!job.svg.empty())
+                writeOverlaySvg(job.svg, relativePath(job.input, dirName(job.svg)), srcw, srch, det);
+            cout << "write detection cost:" << calTimeCost() << endl;
+        }
+        if (job.a4.empty() || !det.found) continue;
+
+        // 只读入原图中四边形的包围盒部分，四周多留2个像素供插值，顶点坐标改为相对于该部分
+        int rx0 = INT_MAX, ry0 = INT_MAX, rx1 = 0, ry1 = 0;
+        for (int i = 0; i < 4; i++) {
+            rx0 = min(rx0, (int)floor(srcp[i].x) - 2);
+            ry0 = min(ry0, (int)floor(srcp[i].y) - 2);
+            rx1 = max(rx1, (int)ceil(srcp[i].x) + 2);
+            ry1 = max(ry1, (int)ceil(srcp[i].y) + 2);
+        }
+        if (reduced == 1) {
+            cropRegion(limg, rimg, rx0, ry0, rx1, ry1);
+        } else {
+            try {
+                loadImageRegion(file.c_str(), rimg, rx0, ry0, rx1, ry1);
+            } catch (CImgException &) {
+                failed++;
+                cerr << file << ": load failed, skipped" << endl;
+                continue;
+            }
+        }
+        for (int i = 0; i < 4; i++) {
+            srcp[i].x -= rx0;
+            srcp[i].y -= ry0;
+        }
+        cout << "load region cost:" << calTimeCost() << endl;
 
-        a4.save((name + "_a4.jpg").c_str());
-        cout << "save cost:" << calTimeCost() << endl;
+        // 将原图中的四边形投影映射到A4中，边映射边写入JPEG
+        writer.saveMapping(rimg, a4w, a4h, srcp, a4p, job.a4);
+        cout << "projective mapping and save cost:" << calTimeCost() << endl;
     }
+    calTimeCost();
+    // 后台写出失败的文件同样在结束时返回1
+    int unwritten = writer.flush();
+    delete video;
+    delete log;
+    cout << "flush cost:" << calTimeCost() << endl;
+    if (failed) cerr << failed << " image(s) failed" << endl;
+    if (unwritten) cerr << unwritten << " output file(s) failed to write" << endl;
+    return failed || unwritten ? 1 : 0;
 }
@@ -1,8 +1,20 @@
 #include "CImg.h"
 #include <cmath>
 #include <algorithm>
+#include <climits>
+#include <cctype>
 #include <list>
+#include <deque>
 #include <vector>
+#include <string>
+#include <map>
+#include <iostream>
+#if cimg_OS != 2
+#include <pthread.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 using namespace cimg_library;
 using namespace std;
@@ -20,10 +32,13 @@ typedef struct Point {
     }
 } point;
 
+// 返回距上次调用经过的秒数，按实际经过的时间计算，不用clock()统计的进程CPU时间，
+// 后者会把预读与写出线程占用的时间也算进来
 double calTimeCost() {
-    static clock_t start = clock();
-    double re = ((double)clock() - start) / CLOCKS_PER_SEC;
-    start = clock();
+    static unsigned long start = cimg::time();
+    unsigned long now = cimg::time();
+    double re = (now - start) / 1000.0;
+    start = now;
     return re;
 }
 
@@ -84,8 +99,8 @@ CImg<> getVote(CImg<unsigned char> const &img) {
     return vote;
 }
 
-// 返回从vote结果得到的直线
-std::list<point> getLinesFromVote(CImg<> &vote, point imgsize) {
+// 返回从vote结果得到的直线，scores不为空时依次存入各直线的得分，即平滑后该峰值区域中的最大票数
+std::list<point> getLinesFromVote(CImg<> &vote, point imgsize, std::vector<double> *scores = 0) {
     double rhomax = sqrt((double)(imgsize.x * imgsize.x + imgsize.y * imgsize.y)) / 2;
 
     // 对vote高斯平滑后以128为阀值筛选，之后再进行腐蚀操作
@@ -97,7 +112,7 @@ std::list<point> getLinesFromVote(CImg<> &vote, point imgsize) {
     std::list<point> ps;
     cimg_forXY(vote, x, y) {
         if (vote(x, y) > 0) {
-            double sum = 0, sumx = 0, sumy = 0;
+            double sum = 0, sumx = 0, sumy = 0, peak = vote(x, y);
             vote(x, y) = 0;
             std::list< point > l;
             l.push_back(point(x, y));
@@ -107,12 +122,14 @@ std::list<point> getLinesFromVote(CImg<> &vote, point imgsize) {
                 sum++; sumx += tx; sumy += ty;
                 for (int i = -1; i <= 1; i++) for (int j = -1; j <= 1; j++)
                     if (vote(tx + i, ty + j) > 0) {
+                        peak = std::max(peak, (double)vote(tx + i, ty + j));
                         vote(tx + i, ty + j) = 0;
                         l.push_back(point(tx + i, ty + j));
                     }
             }
             ps.push_back(point( (sumx / sum) * thetamax / vote.width(),
                                 (sumy / sum) * rhomax  / vote.height() ));
+            if (scores) scores->push_back(peak);
         }
     }
     return ps;
@@ -184,6 +201,7 @@ getPointFromLines(list<point> &lines, vector< pair<point, point> > &re, point im
             }
         }
     }
+    return re;
 }
 
 // 对p中四个点按顺时针排序(top-left, top-right, bot-right, bot-left)
@@ -308,135 +326,881 @@ double bilinearInterpolation(CImg<> const &src, point const &p, int colon = 0) {
     return color;
 }
 
-// 将src中的四边形映射为dst中的四边形，对应的四个角点存储在Points中
-void projectiveMapping(CImg<> &src, CImg<> &dst, point *sPoints, point *dPoints) {
-    double *sH = new double[18], *dH = new double[18];
+// 计算3*3矩阵乘积C = A * B
+void matrixCompose(double const *A, double const *B, double *C) {
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            C[i * 3 + j] = A[i * 3] * B[j] + A[i * 3 + 1] * B[3 + j] + A[i * 3 + 2] * B[6 + j];
+}
+
+// 映射的类型：一般透视变换、仿射变换、仅含缩放和平移的变换
+enum TransformType { PERSPECTIVE, AFFINE, SCALE_TRANSLATE };
+
+// 判断由dst映射到src的矩阵M(M[8]须为1)在w*h的画布上属于哪种变换
+// 将透视项置0后，若画布四角的映射偏差都小于tol个像素，则视为仿射变换
+TransformType classifyTransform(double const *M, int w, int h, double tol = 0.1) {
+    double cx[4] = {0, (double)w - 1, (double)w - 1, 0},
+           cy[4] = {0, 0, (double)h - 1, (double)h - 1};
+    for (int i = 0; i < 4; i++) {
+        double z  = M[6] * cx[i] + M[7] * cy[i] + 1;
+        double ax = M[0] * cx[i] + M[1] * cy[i] + M[2],
+               ay = M[3] * cx[i] + M[4] * cy[i] + M[5];
+        if (fabs(ax / z - ax) > tol || fabs(ay / z - ay) > tol) return PERSPECTIVE;
+    }
+    // 交叉项在整个画布上的影响同样不超过tol时，x只依赖列、y只依赖行
+    if (fabs(M[1]) * h < tol && fabs(M[3]) * w < tol) return SCALE_TRANSLATE;
+    return AFFINE;
+}
+
+// 将插值结果写入像素，整数类型需四舍五入并截断到取值范围内
+inline void storePixel(float &d, double v) { d = (float)v; }
+inline void storePixel(double &d, double v) { d = v; }
+inline void storePixel(unsigned char &d, double v) {
+    d = (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v + 0.5));
+}
+inline void storePixel(unsigned short &d, double v) {
+    d = (unsigned short)(v < 0 ? 0 : (v > 65535 ? 65535 : v + 0.5));
+}
+
+// 通道数，C不为0时在编译期确定，通道循环可以完全展开；C为0时使用img的实际通道数
+template <int C, typename T>
+inline int numChannels(CImg<T> const &img) {
+    return C ? C : img.spectrum();
+}
+
+// 返回下标i截断到[0, n - 1]后的结果
+inline int clampIndex(int i, int n) {
+    return i < 0 ? 0 : (i >= n ? n - 1 : i);
+}
+
+// 将坐标o截断到[0, n - 1]内，返回左侧整点及右侧整点，frac为小数部分
+inline void clampSample(double o, int n, unsigned int &i0, unsigned int &i1, double &frac) {
+    if (o < 0) o = 0;
+    if (o > n - 1) o = n - 1;
+    i0 = (unsigned int)o;
+    i1 = (i0 + 1 >= (unsigned int)n ? i0 : i0 + 1);
+    frac = o - i0;
+}
+
+// 以下为插值核，作为模板参数传给映射函数，在编译期确定所用的插值方法
+// 每个核提供sample<C>(src, ox, oy, dst, x, y)，对src中(ox, oy)处的所有通道插值并写入dst(x, y)，
+// C为编译期确定的通道数，为0时按dst的实际通道数处理
+// 核读取的邻点为floor(o) - before到floor(o) + after，before <= o < n - after时邻点都在图内，
+// 此时可以调用不截断坐标的sampleInside<C>
+
+// 最近邻插值
+struct NearestKernel {
+    enum { before = 0, after = 1 };
+    template <int C, typename T, typename D>
+    static void sample(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        int ix = clampIndex((int)std::floor(ox + 0.5), src.width()),
+            iy = clampIndex((int)std::floor(oy + 0.5), src.height());
+        for (int v = 0; v < numChannels<C>(dst); v++) storePixel(dst(x, y, v), src(ix, iy, v));
+    }
+    template <int C, typename T, typename D>
+    static void sampleInside(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        int ix = (int)(ox + 0.5), iy = (int)(oy + 0.5);
+        for (int v = 0; v < numChannels<C>(dst); v++) storePixel(dst(x, y, v), src(ix, iy, v));
+    }
+};
+
+// 双线性插值
+struct BilinearKernel {
+    enum { before = 0, after = 1 };
+    template <int C, typename T, typename D>
+    static void sample(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        unsigned int ix0, iy0, ix1, iy1;
+        double px, py;
+        clampSample(ox, src.width(),  ix0, ix1, px);
+        clampSample(oy, src.height(), iy0, iy1, py);
+        blend<C>(src, ix0, iy0, ix1 - ix0, (unsigned long)(iy1 - iy0) * src.width(), px, py, dst, x, y);
+    }
+    // 四个邻点都在图内，右侧和下方的邻点总是相邻的像素
+    template <int C, typename T, typename D>
+    static void sampleInside(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        unsigned int ix0 = (unsigned int)ox, iy0 = (unsigned int)oy;
+        blend<C>(src, ix0, iy0, 1, src.width(), ox - ix0, oy - iy0, dst, x, y);
+    }
+    // 四个邻点相对(ix0, iy0)的偏移在各通道中相同，只算一次
+    template <int C, typename T, typename D>
+    static void blend(CImg<T> const &src, unsigned int ix0, unsigned int iy0, unsigned long dx, unsigned long dy,
+                      double px, double py, CImg<D> &dst, int x, int y) {
+        const T *p = src.data(ix0, iy0);
+        unsigned long dc = (unsigned long)src.width() * src.height();
+        double w00 = (1 - px) * (1 - py), w01 = (1 - px) * py, w10 = px * (1 - py), w11 = px * py;
+        for (int v = 0; v < numChannels<C>(dst); v++, p += dc)
+            storePixel(dst(x, y, v), p[0] * w00 + p[dy] * w01 + p[dx] * w10 + p[dx + dy] * w11);
+    }
+};
+
+// 可分离插值核的权重表，将小数部分量化为PHASES段，每段预先算好2*radius个归一化的权重
+template <class K>
+struct WeightTable {
+    enum { PHASES = 256, TAPS = 2 * K::radius };
+    double w[PHASES + 1][TAPS];
+
+    WeightTable() {
+        for (int p = 0; p <= PHASES; p++) {
+            double t = (double)p / PHASES, sum = 0;
+            for (int i = 0; i < TAPS; i++) sum += (w[p][i] = K::weight(i - (K::radius - 1) - t));
+            for (int i = 0; i < TAPS; i++) w[p][i] /= sum;
+        }
+    }
+
+    static WeightTable const &get() {
+        static WeightTable table;
+        return table;
+    }
+};
+
+// 按权重表做可分离插值，先沿x方向对2*radius行分别加权，再沿y方向加权
+// Clamp为false时调用方保证所有邻点都在图内，不再截断下标
+template <class K, int C, bool Clamp, typename T, typename D>
+void separableSample(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+    enum { R = K::radius, TAPS = 2 * K::radius, PHASES = WeightTable<K>::PHASES };
+    WeightTable<K> const &table = WeightTable<K>::get();
+    int ix = (int)std::floor(ox), iy = (int)std::floor(oy);
+    double const *wx = table.w[(int)((ox - ix) * PHASES + 0.5)],
+                 *wy = table.w[(int)((oy - iy) * PHASES + 0.5)];
+    int xs[TAPS], ys[TAPS];
+    for (int i = 0; i < TAPS; i++) {
+        xs[i] = Clamp ? clampIndex(ix - R + 1 + i, src.width())  : ix - R + 1 + i;
+        ys[i] = Clamp ? clampIndex(iy - R + 1 + i, src.height()) : iy - R + 1 + i;
+    }
+    for (int v = 0; v < numChannels<C>(dst); v++) {
+        double sum = 0;
+        for (int j = 0; j < TAPS; j++) {
+            const T *row = src.data(0, ys[j], 0, v);
+            double rsum = 0;
+            for (int i = 0; i < TAPS; i++) rsum += wx[i] * row[xs[i]];
+            sum += wy[j] * rsum;
+        }
+        storePixel(dst(x, y, v), sum);
+    }
+}
+
+// 双三次插值(Catmull-Rom，a = -0.5)
+struct BicubicKernel {
+    enum { radius = 2, before = radius - 1, after = radius };
+    static double weight(double t) {
+        t = fabs(t);
+        if (t < 1) return (1.5 * t - 2.5) * t * t + 1;
+        if (t < 2) return ((-0.5 * t + 2.5) * t - 4) * t + 2;
+        return 0;
+    }
+    template <int C, typename T, typename D>
+    static void sample(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        separableSample<BicubicKernel, C, true>(src, ox, oy, dst, x, y);
+    }
+    template <int C, typename T, typename D>
+    static void sampleInside(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        separableSample<BicubicKernel, C, false>(src, ox, oy, dst, x, y);
+    }
+};
+
+// Lanczos插值，a = 3
+struct LanczosKernel {
+    enum { radius = 3, before = radius - 1, after = radius };
+    static double weight(double t) {
+        if (fabs(t) < EPS) return 1;
+        if (fabs(t) >= radius) return 0;
+        double pt = cimg::PI * t;
+        return radius * sin(pt) * sin(pt / radius) / (pt * pt);
+    }
+    template <int C, typename T, typename D>
+    static void sample(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        separableSample<LanczosKernel, C, true>(src, ox, oy, dst, x, y);
+    }
+    template <int C, typename T, typename D>
+    static void sampleInside(CImg<T> const &src, double ox, double oy, CImg<D> &dst, int x, int y) {
+        separableSample<LanczosKernel, C, false>(src, ox, oy, dst, x, y);
+    }
+};
+
+
+// 一般透视映射，每个像素只做一次除法
+template <class K, int C, typename T, typename D>
+void perspectiveKernel(CImg<T> const &src, CImg<D> &dst, double const *M) {
+    cimg_forXY(dst, x, y) {
+        double z = 1 / (M[6] * x + M[7] * y + 1);
+        K::template sample<C>(src, (M[0] * x + M[1] * y + M[2]) * z,
+                                   (M[3] * x + M[4] * y + M[5]) * z, dst, x, y);
+    }
+}
+
+// 仿射映射，每行的起点由矩阵算出，行内按常数步长递推，不做除法
+template <class K, int C, typename T, typename D>
+void affineKernel(CImg<T> const &src, CImg<D> &dst, double const *M) {
+    cimg_forY(dst, y) {
+        double ox = M[1] * y + M[2], oy = M[4] * y + M[5];
+        cimg_forX(dst, x) {
+            K::template sample<C>(src, ox, oy, dst, x, y);
+            ox += M[0];
+            oy += M[3];
+        }
+    }
+}
+
+// 仅含缩放和平移的映射，每列的x坐标只算一次
+template <class K, int C, typename T, typename D>
+void scaleTranslateKernel(CImg<T> const &src, CImg<D> &dst, double const *M) {
+    vector<double> ox(dst.width());
+    cimg_forX(dst, x) ox[x] = M[0] * x + M[2];
+    cimg_forY(dst, y) {
+        double oy = M[4] * y + M[5];
+        cimg_forX(dst, x) K::template sample<C>(src, ox[x], oy, dst, x, y);
+    }
+}
+
+// 根据映射矩阵的类型选用对应的映射方法
+template <class K, int C, typename T, typename D>
+void warpKernel(CImg<T> const &src, CImg<D> &dst, double const *M, TransformType type) {
+    switch (type) {
+        case SCALE_TRANSLATE: scaleTranslateKernel<K, C>(src, dst, M); break;
+        case AFFINE:          affineKernel<K, C>(src, dst, M);         break;
+        default:              perspectiveKernel<K, C>(src, dst, M);
+    }
+}
+
+// 按通道数选用编译期确定通道数的映射方法，1、3通道以外按运行时的通道数处理
+template <class K, typename T, typename D>
+void warpKernel(CImg<T> const &src, CImg<D> &dst, double const *M, TransformType type) {
+    switch (dst.spectrum()) {
+        case 1:  warpKernel<K, 1>(src, dst, M, type); break;
+        case 3:  warpKernel<K, 3>(src, dst, M, type); break;
+        default: warpKernel<K, 0>(src, dst, M, type);
+    }
+}
+
+// 由src与dst中对应的四个角点求出从dst映射回src的矩阵M，M[8]归一化为1
+// 先将原图投影到1*1正方形中，再将正方形投影到A4中，两步合成为一个矩阵
+void getMappingMatrix(point *sPoints, point *dPoints, double *M) {
+    double sH[18], dH[18];
     getPerspectiveTransform(sPoints, sH);
     getPerspectiveTransform(dPoints, dH);
-    // 先将原图投影到1*1正方形中，再将正方形投影到A4中
-    cimg_forXYC(dst, x, y, v) {
-        point d(x, y);
-        matricmul(d, dH + 9);
-        matricmul(d, sH);
-        dst(x, y, v) = bilinearInterpolation(src, d, v);
+    matrixCompose(sH, dH + 9, M);
+    for (int i = 0; i < 8; i++) M[i] /= M[8];
+    M[8] = 1;
+}
+
+// 将src中的四边形映射为dst中的四边形，对应的四个角点存储在Points中，K为插值核
+template <class K, typename T, typename D>
+void projectiveMapping(CImg<T> &src, CImg<D> &dst, point *sPoints, point *dPoints) {
+    double M[9];
+    getMappingMatrix(sPoints, dPoints, M);
+    warpKernel<K>(src, dst, M, classifyTransform(M, dst.width(), dst.height()));
+}
+
+template <typename T, typename D>
+void projectiveMapping(CImg<T> &src, CImg<D> &dst, point *sPoints, point *dPoints) {
+    projectiveMapping<BilinearKernel>(src, dst, sPoints, dPoints);
+}
+
+// 将img按2*2区域取平均缩小一半，奇数边长时最后一行(列)与自身平均
+template <typename T>
+CImg<T> halfDownsample(CImg<T> const &img) {
+    CImg<T> re((img.width() + 1) / 2, (img.height() + 1) / 2, 1, img.spectrum());
+    int w = img.width(), h = img.height();
+    cimg_forXYC(re, x, y, v) {
+        int x0 = 2 * x, y0 = 2 * y,
+            x1 = (x0 + 1 < w ? x0 + 1 : x0),
+            y1 = (y0 + 1 < h ? y0 + 1 : y0);
+        storePixel(re(x, y, v), ((double)img(x0, y0, v) + img(x1, y0, v) + img(x0, y1, v) + img(x1, y1, v)) / 4);
+    }
+    return re;
+}
+
+// 原图的图像金字塔，第l层的边长为原图的1/2^l，每层只在第一次用到时计算
+template <typename T>
+struct MipPyramid {
+    CImg<T> const &base;
+    vector< CImg<T> > levels;   // levels[i]为第i+1层
+
+    MipPyramid(CImg<T> const &src) : base(src) {}
+
+    CImg<T> const &level(int l) {
+        if (l <= 0) return base;
+        while ((int)levels.size() < l)
+            levels.push_back(halfDownsample(levels.empty() ? base : levels.back()));
+        return levels[l - 1];
+    }
+
+    // 最高层，边长缩到1为止
+    int maxLevel() const {
+        int l = 0;
+        for (int s = std::max(base.width(), base.height()); s > 1; s = (s + 1) / 2) l++;
+        return l;
+    }
+};
+
+// 返回矩阵M在dst中(x, y)处的局部缩放率，即dst中一个像素对应原图中的像素数
+// 取雅可比矩阵两列长度中较大者
+double mappingScale(double const *M, double x, double y) {
+    double z = M[6] * x + M[7] * y + 1;
+    double u = (M[0] * x + M[1] * y + M[2]) / z,
+           v = (M[3] * x + M[4] * y + M[5]) / z;
+    double ux = (M[0] - u * M[6]) / z, uy = (M[1] - u * M[7]) / z,
+           vx = (M[3] - v * M[6]) / z, vy = (M[4] - v * M[7]) / z;
+    return std::max(sqrt(ux * ux + vx * vx), sqrt(uy * uy + vy * vy));
+}
+
+// 带图像金字塔的映射核心，dst按tile*tile分块，每块按块中心的缩放率选取金字塔层，
+// 使采样密度与该层像素密度相当
+template <class K, int C, typename T, typename D>
+void mipKernel(CImg<D> &dst, double const *M, MipPyramid<T> &pyr, int tile) {
+    int w = dst.width(), h = dst.height(), top = pyr.maxLevel();
+    for (int ty = 0; ty < h; ty += tile) {
+        for (int tx = 0; tx < w; tx += tile) {
+            int ex = std::min(tx + tile, w), ey = std::min(ty + tile, h);
+            double scale = mappingScale(M, (tx + ex - 1) / 2.0, (ty + ey - 1) / 2.0);
+            int l = scale < 2 ? 0 : std::min((int)std::floor(log(scale) / log(2.0)), top);
+            CImg<T> const &lv = pyr.level(l);
+            double k = 1.0 / (1 << l);
+            for (int y = ty; y < ey; y++) {
+                for (int x = tx; x < ex; x++) {
+                    double z = 1 / (M[6] * x + M[7] * y + 1);
+                    // 原图坐标(o + 0.5) / 2^l - 0.5即为第l层中的坐标
+                    K::template sample<C>(lv, ((M[0] * x + M[1] * y + M[2]) * z + 0.5) * k - 0.5,
+                                              ((M[3] * x + M[4] * y + M[5]) * z + 0.5) * k - 0.5, dst, x, y);
+                }
+            }
+        }
+    }
+}
+
+template <class K, typename T, typename D>
+void mipKernel(CImg<D> &dst, double const *M, MipPyramid<T> &pyr, int tile = 64) {
+    switch (dst.spectrum()) {
+        case 1:  mipKernel<K, 1>(dst, M, pyr, tile); break;
+        case 3:  mipKernel<K, 3>(dst, M, pyr, tile); break;
+        default: mipKernel<K, 0>(dst, M, pyr, tile);
+    }
+}
+
+// 返回矩阵M在w*h画布四角处缩放率的最大值
+double maxMappingScale(double const *M, int w, int h) {
+    return std::max(std::max(mappingScale(M, 0, 0),     mappingScale(M, w - 1, 0)),
+                    std::max(mappingScale(M, 0, h - 1), mappingScale(M, w - 1, h - 1)));
+}
+
+// 带图像金字塔的投影映射，用于原图中的四边形远大于dst的情况
+// 若整幅dst都不需要缩小，直接使用projectiveMapping
+template <class K, typename T, typename D>
+void projectiveMappingMip(CImg<T> &src, CImg<D> &dst, point *sPoints, point *dPoints, int tile = 64) {
+    double M[9];
+    getMappingMatrix(sPoints, dPoints, M);
+    if (maxMappingScale(M, dst.width(), dst.height()) < 2) {
+        projectiveMapping<K>(src, dst, sPoints, dPoints);
+        return;
+    }
+    MipPyramid<T> pyr(src);
+    mipKernel<K>(dst, M, pyr, tile);
+}
+
+template <typename T, typename D>
+void projectiveMappingMip(CImg<T> &src, CImg<D> &dst, point *sPoints, point *dPoints, int tile = 64) {
+    projectiveMappingMip<BilinearKernel>(src, dst, sPoints, dPoints, tile);
+}
+
+// 将dst中的y坐标平移y0后的映射矩阵写入Mb，即Mb(x, y) = M(x, y + y0)
+void shiftMatrixRows(double const *M, int y0, double *Mb) {
+    for (int i = 0; i < 9; i++) Mb[i] = M[i];
+    Mb[2] += M[1] * y0;
+    Mb[5] += M[4] * y0;
+    Mb[8] += M[7] * y0;
+    for (int i = 0; i < 8; i++) Mb[i] /= Mb[8];
+    Mb[8] = 1;
+}
+
+// 将src中的四边形映射为w*h的图像并直接以JPEG格式写入filename
+// 每次只映射band行，转为8位后逐行交给编码器，不需要分配整幅w*h的浮点画布
+// 未定义cimg_use_jpeg时退化为先映射整幅图像再按quality保存，band不起作用
+template <class K, typename T>
+void projectiveMappingToJpeg(CImg<T> &src, int w, int h, point *sPoints, point *dPoints,
+                             const char *filename, int quality = 100, int band = 16) {
+#ifdef cimg_use_jpeg
+    double M[9], Mb[9];
+    getMappingMatrix(sPoints, dPoints, M);
+    TransformType type = classifyTransform(M, w, h);
+    bool useMip = maxMappingScale(M, w, h) >= 2;
+    MipPyramid<T> pyr(src);
+
+    int spectrum = src.spectrum() >= 3 ? 3 : 1;
+    typedef CImg<unsigned char> Img;
+    struct jpeg_compress_struct cinfo;
+    Img::_cimg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr.original);
+    jerr.original.error_exit = Img::_cimg_jpeg_error_exit;
+    std::FILE *file = cimg::fopen(filename, "wb");
+    // 带析构函数的对象都在setjmp之前定义，longjmp不会跳过它们的析构
+    CImg<> buf;
+    vector<unsigned char> row;
+    // libjpeg出错(如磁盘已满)时回到这里，删去写了一半的文件并抛出异常，由调用者处理，不会结束整个进程
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_compress(&cinfo);
+        cimg::fclose(file);
+        std::remove(filename);
+        throw CImgIOException("projectiveMappingToJpeg(): Error message returned by libjpeg: %s.", jerr.message);
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, file);
+    cinfo.image_width = w;
+    cinfo.image_height = h;
+    cinfo.input_components = spectrum;
+    cinfo.in_color_space = spectrum == 3 ? JCS_RGB : JCS_GRAYSCALE;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality < 100 ? quality : 100, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    buf.assign(w, band, 1, src.spectrum());
+    row.resize(w * spectrum);
+    for (int y0 = 0; y0 < h; y0 += band) {
+        if (y0 + band > h) buf.assign(w, h - y0, 1, src.spectrum());
+        shiftMatrixRows(M, y0, Mb);
+        if (useMip) mipKernel<K>(buf, Mb, pyr);
+        else warpKernel<K>(src, buf, Mb, type);
+
+        // 转为按像素交错的8位数据逐行写入
+        cimg_forY(buf, y) {
+            unsigned char *ptr = &row[0];
+            cimg_forX(buf, x) for (int v = 0; v < spectrum; v++)
+                *(ptr++) = (unsigned char)std::max(0.0f, std::min(255.0f, buf(x, y, v)));
+            JSAMPROW scanline = &row[0];
+            jpeg_write_scanlines(&cinfo, &scanline, 1);
+        }
+    }
+
+    jpeg_finish_compress(&cinfo);
+    cimg::fclose(file);
+    jpeg_destroy_compress(&cinfo);
+#else
+    CImg<> dst(w, h, 1, src.spectrum(), 0);
+    projectiveMappingMip<K>(src, dst, sPoints, dPoints);
+    dst.save_jpeg(filename, quality < 100 ? quality : 100);
+    cimg::unused(band);
+#endif
+}
+
+template <typename T>
+void projectiveMappingToJpeg(CImg<T> &src, int w, int h, point *sPoints, point *dPoints,
+                             const char *filename, int quality = 100, int band = 16) {
+    projectiveMappingToJpeg<BilinearKernel>(src, w, h, sPoints, dPoints, filename, quality, band);
+}
+
+// 面积平均缩放时一个方向上的权重表
+// 输出下标o对应原图中[start[o], start[o] + taps)内的像素，权重为weight[o * taps + k]
+// 每个权重为输出像素覆盖的区间与原图像素的重叠长度，归一化后和为1，不足taps个时补0
+struct AreaWeights {
+    int taps;
+    vector<int> start;
+    vector<float> weight;
+
+    AreaWeights(int srcn, int dstn) : start(dstn) {
+        double scale = (double)srcn / dstn;
+        taps = (int)std::ceil(scale) + 1;
+        if (taps > srcn) taps = srcn;
+        weight.assign(dstn * taps, 0);
+        for (int o = 0; o < dstn; o++) {
+            double a = o * scale, b = std::min((o + 1) * scale, (double)srcn);
+            int s = std::min((int)a, srcn - taps);
+            start[o] = s;
+            for (int k = 0; k < taps; k++) {
+                double overlap = std::min(b, s + k + 1.0) - std::max(a, (double)s + k);
+                if (overlap > 0) weight[o * taps + k] = overlap / (b - a);
+            }
+        }
+    }
+};
+
+// 用于将图片缩放size倍，每个输出像素取其覆盖的原图区域的面积平均
+// 权重表在每个方向上只算一次，先逐行做水平方向的加权，再对整行做竖直方向的加权
+template <typename T>
+CImg<T> myresize(CImg<T>& img, double size) {
+    if (size == 1) return img;
+    int nw = img.width() * size, nh = img.height() * size;
+    if (nw <= 0 || nh <= 0) return CImg<T>();
+    AreaWeights wx(img.width(), nw), wy(img.height(), nh);
+    CImg<T> re(nw, nh, 1, img.spectrum(), 0);
+
+    // 水平方向，tmp的每行对应原图的一行
+    CImg<float> tmp(nw, img.height(), 1, img.spectrum());
+    cimg_forYC(img, y, v) {
+        const T *srow = img.data(0, y, 0, v);
+        float *trow = tmp.data(0, y, 0, v);
+        for (int x = 0; x < nw; x++) {
+            const T *s = srow + wx.start[x];
+            const float *w = &wx.weight[x * wx.taps];
+            float sum = 0;
+            for (int k = 0; k < wx.taps; k++) sum += w[k] * s[k];
+            trow[x] = sum;
+        }
     }
-    delete []sH;
-    delete []dH;
+
+    // 竖直方向，每个输出行为tmp中若干整行的加权和
+    vector<float> acc(nw);
+    cimg_forYC(re, y, v) {
+        std::fill(acc.begin(), acc.end(), 0.0f);
+        for (int k = 0; k < wy.taps; k++) {
+            float w = wy.weight[y * wy.taps + k];
+            if (w == 0) continue;
+            const float *trow = tmp.data(0, wy.start[y] + k, 0, v);
+            for (int x = 0; x < nw; x++) acc[x] += w * trow[x];
+        }
+        T *drow = re.data(0, y, 0, v);
+        for (int x = 0; x < nw; x++) storePixel(drow[x], acc[x]);
+    }
+    return re;
 }
 
-// 用于将图片缩放size倍
-CImg<unsigned char> myresize(CImg<unsigned char>& img, double size) {
+// 求出使EPS <= ox0 + dox * x < w且EPS <= oy0 + doy * x < h成立的x的区间[xs, xe]，
+// x限定在[0, n - 1]内，返回false表示区间为空
+// 先解析地解出区间，再用原判定条件修正区间两端的舍入误差
+bool clipSpan(double ox0, double dox, double oy0, double doy, double w, double h, int n, int &xs, int &xe) {
+    double lo = -1, hi = n;
+    double o0[2] = {ox0, oy0}, d[2] = {dox, doy}, lim[2] = {w, h};
+    for (int i = 0; i < 2; i++) {
+        if (fabs(d[i]) < 1e-12) {
+            if (o0[i] < EPS || o0[i] >= lim[i]) return false;
+            continue;
+        }
+        double t1 = (EPS - o0[i]) / d[i], t2 = (lim[i] - o0[i]) / d[i];
+        if (d[i] < 0) std::swap(t1, t2);
+        lo = std::max(lo, t1);
+        hi = std::min(hi, t2);
+    }
+    if (hi < lo) return false;
+    xs = std::max(0, (int)std::ceil(lo) - 1);
+    xe = std::min(n - 1, (int)std::floor(hi) + 1);
+    #define _clipSpan_inside(x) (ox0 + dox * (x) >= EPS && oy0 + doy * (x) >= EPS && \
+                                 ox0 + dox * (x) < w && oy0 + doy * (x) < h)
+    while (xs <= xe && !_clipSpan_inside(xs)) xs++;
+    while (xe >= xs && !_clipSpan_inside(xe)) xe--;
+    #undef _clipSpan_inside
+    return xs <= xe;
+}
+
+// 对dst第y行[xs, xe]内的像素插值，x处对应src中的(ox0 + dox * x, oy0 + doy * x)
+// 行内原图坐标按常数步长递增，C为编译期确定的通道数
+// 邻点都在src内的子区间[is, ie]由clipSpan解出，区间内不截断坐标，两端留EPS抵消步进的累积误差
+template <class K, int C, typename T, typename D>
+void sampleSpan(CImg<T> const &src, double ox0, double dox, double oy0, double doy,
+                CImg<D> &dst, int y, int xs, int xe) {
+    int is, ie;
+    if (!clipSpan(ox0 - K::before, dox, oy0 - K::before, doy, src.width() - K::before - K::after - EPS,
+                  src.height() - K::before - K::after - EPS, xe + 1, is, ie) || (is = std::max(is, xs)) > ie) {
+        is = xe + 1;
+        ie = xe;
+    }
+    double ox = ox0 + dox * xs, oy = oy0 + doy * xs;
+    int x = xs;
+    for (; x < is; x++, ox += dox, oy += doy) K::template sample<C>(src, ox, oy, dst, x, y);
+    for (; x <= ie; x++, ox += dox, oy += doy) K::template sampleInside<C>(src, ox, oy, dst, x, y);
+    for (; x <= xe; x++, ox += dox, oy += doy) K::template sample<C>(src, ox, oy, dst, x, y);
+}
+
+// 按dst的通道数选择展开后的版本，灰度图和RGB图之外的按实际通道数循环
+template <class K, typename T, typename D>
+void sampleSpan(CImg<T> const &src, double ox0, double dox, double oy0, double doy,
+                CImg<D> &dst, int y, int xs, int xe) {
+    switch (dst.spectrum()) {
+        case 1:  sampleSpan<K, 1>(src, ox0, dox, oy0, doy, dst, y, xs, xe); break;
+        case 3:  sampleSpan<K, 3>(src, ox0, dox, oy0, doy, dst, y, xs, xe); break;
+        default: sampleSpan<K, 0>(src, ox0, dox, oy0, doy, dst, y, xs, xe);
+    }
+}
+
+// 用指定的插值核K将图片缩放size倍，输出像素中心对应原图中的(x + 0.5) / size - 0.5
+template <class K, typename T>
+CImg<T> myresize(CImg<T>& img, double size) {
     if (size == 1) return img;
     unsigned int nw = img.width() * size, nh = img.height() * size;
-    CImg<unsigned char> re(nw, nh, 1, 1, 0);
-    cimg_forXY(re, x, y) {
-
-        // // 双线性插值
-        // double ox = x / size, oy = y / size;
-        // unsigned int ix0 = (unsigned int)ox, iy0 = (unsigned int)oy;
-        // unsigned int ix1 = (ix0 + 1 >= img.width() ? ix0 : ix0 + 1), \
-        //     iy1 = (iy0 + 1 >= img.height() ? iy0 : iy0 + 1);
-        // double px = ox - ix0, py = oy - iy0;
-        // double color = img(ix0, iy0) * (1- px) * (1 - py) + \
-        //                img(ix1, iy0) * px * (1- py) + \
-        //                img(ix0, iy1) * (1 - px) * py + \
-        //                img(ix1, iy1) * px * py;
-
-        // re(x, y) = std::floor(color + 0.5);
-
-        double ox = x / size, oy = y / size, oxx = (x + 1) / size, oyy = (y + 1) / size;
-        unsigned int xlu = std::floor(ox), ylu = std::floor(oy), \
-            xrd = std::ceil(oxx), yrd = std::ceil(oyy);
-        double csum = 0.0, psum = 0.0, p = 1.0;
-        for (unsigned int i = xlu; i < xrd; i++) {
-            for (unsigned int j = ylu; j < yrd; j++) {
-                p = 1.0;
-                if (x < ox) p *= (1 - (ox - x));
-                else if (x > oxx) p *= (1 - (x - oxx));
-                if (y < ox) p *= (1 - (oy - y));
-                else if (y > oyy) p *= (1 - (y - oyy));
-                csum += img(i, j) * p;
-                psum += p;
+    CImg<T> re(nw, nh, 1, img.spectrum(), 0);
+    cimg_forY(re, y) sampleSpan<K>(img, 0.5 / size - 0.5, 1 / size, (y + 0.5) / size - 0.5, 0, re, y, 0, re.width() - 1);
+    return re;
+}
+
+// 分块旋转90度(CW为true，顺时针)或270度，每次处理TILE*TILE的一块，
+// 块内读取的原图行和写入的结果行都留在缓存中
+// 原图(sx, sy)顺时针旋转90度后位于(h - 1 - sy, sx)，旋转270度后位于(sy, w - 1 - sx)
+template <bool CW, typename T>
+void quarterTurn(CImg<T> const &img, CImg<T> &re) {
+    const int TILE = 16;
+    int w = img.width(), h = img.height(), stride = re.width();
+    cimg_forC(img, v) {
+        for (int sy0 = 0; sy0 < h; sy0 += TILE) {
+            int sy1 = std::min(sy0 + TILE, h);
+            for (int sx0 = 0; sx0 < w; sx0 += TILE) {
+                int sx1 = std::min(sx0 + TILE, w);
+                for (int sy = sy0; sy < sy1; sy++) {
+                    const T *s = img.data(0, sy, 0, v);
+                    T *d = CW ? re.data(h - 1 - sy, sx0, 0, v)
+                                          : re.data(sy, w - 1 - sx0, 0, v);
+                    for (int sx = sx0; sx < sx1; sx++, d += CW ? stride : -stride) *d = s[sx];
+                }
             }
         }
-        re(x, y) = (unsigned char)(csum / psum);
     }
-    return re;
 }
 
 // 用于将图片顺时针旋转90、180、270
-CImg<unsigned char> mytran(CImg<unsigned char>& img, unsigned int t) {
+template <typename T>
+CImg<T> mytran(CImg<T>& img, unsigned int t) {
     switch(t) {
         case 1: {
             // 旋转90
-            CImg<unsigned char> re(img.height(), img.width());
-            cimg_forXY(re, x, y) {
-                re(x, y) = img(y, img.width() - x);
-            }
+            CImg<T> re(img.height(), img.width(), 1, img.spectrum());
+            quarterTurn<true>(img, re);
             return re;
-            break;
         }
         case 2: {
-            // 旋转180
-            CImg<unsigned char> re(img.width(), img.height());
-            cimg_forXY(re, x, y) {
-                re(x, y) = img(img.width() - x, img.width() - y);
-            }
+            // 旋转180，即每个通道的数据倒序
+            CImg<T> re(img.width(), img.height(), 1, img.spectrum());
+            unsigned long n = (unsigned long)img.width() * img.height();
+            cimg_forC(img, v) std::reverse_copy(img.data(0, 0, 0, v), img.data(0, 0, 0, v) + n, re.data(0, 0, 0, v));
             return re;
-            break;
         }
         case 3: {
             // 旋转270
-            CImg<unsigned char> re(img.height(), img.width());
-            cimg_forXY(re, x, y) {
-                re(x, y) = img(img.height() - y, x);
-            }
+            CImg<T> re(img.height(), img.width(), 1, img.spectrum());
+            quarterTurn<false>(img, re);
             return re;
-            break;
         }
         default: {
             // 不旋转
-            CImg<unsigned char> re(img);
+            CImg<T> re(img);
             return re;
         }
     }
 }
 
-// 用于旋转图片，angle为一平面角
-CImg<unsigned char> myrotate(CImg<unsigned char>& img, double angle) {
+// 用于旋转图片，angle为一平面角，K为插值核
+// 结果图中每一行对应原图中的一条直线段，该行内原图坐标按常数步长变化，
+// 因此先解析地求出该行落在原图内的区间，只对区间内的像素插值，区间外的角落保持为0
+template <class K, typename T>
+CImg<T> myrotate(CImg<T>& img, double angle) {
     unsigned int angle2 = (unsigned int)angle % 360;
-    CImg<unsigned char> tranedImg = mytran(img, angle2 / 90);
+    CImg<T> tranedImg = mytran(img, angle2 / 90);
     angle2 %= 90;
     if (angle2 == 0) return tranedImg;
 
     angle = angle2 + (angle - (unsigned int)angle);
     angle = angle / 180 * cimg::PI;
+    double cosa = std::cos(angle), sina = std::sin(angle);
+    int tw = tranedImg.width(), th = tranedImg.height();
 
-    unsigned int nw = tranedImg.width() * std::sin(angle) + tranedImg.height() * std::cos(angle), \
-        nh = tranedImg.width() * std::cos(angle) + tranedImg.height() * std::sin(angle);
+    unsigned int nw = tw * cosa + th * sina, \
+        nh = tw * sina + th * cosa;
 
-    CImg<unsigned char> re(nw, nh, 1, 1, 0);
-    double transMidx = tranedImg.width() / 2.0, transMidy = tranedImg.height() / 2.0, \
+    CImg<T> re(nw, nh, 1, tranedImg.spectrum(), 0);
+    double transMidx = tw / 2.0, transMidy = th / 2.0, \
            resMidX = re.width() / 2.0, resMidy = re.height() / 2.0;
 
-    cimg_forXY(re, x, y) {
-        // 遍历旋转后图片的像素点，计算出对应的原图中的位置，若无对应则跳过
-        // 先把坐标系转换为以图像中心为原点的极坐标系，计算后再将极坐标系转换为直角坐标
-        double ox = transMidx + std::cos(angle) * (x - resMidX) - std::sin(angle) * (resMidy - y), \
-               oy = transMidy - std::sin(angle) * (x - resMidX) - std::cos(angle) * (resMidy - y);
+    cimg_forY(re, y) {
+        // 计算出该行x = 0处对应的原图中的位置，x每加1，ox增加cosa，oy减少sina
+        // 先把坐标系转换为以图像中心为原点的坐标系，旋转后再转换回原图坐标
+        double ox0 = transMidx - cosa * resMidX - sina * (resMidy - y),
+               oy0 = transMidy + sina * resMidX - cosa * (resMidy - y);
 
-        if (ox < EPS || oy < EPS || ox >= tranedImg.width() ||  oy >= tranedImg.height()) {
-            continue;
+        int xs, xe;
+        if (clipSpan(ox0, cosa, oy0, -sina, tw, th, nw, xs, xe))
+            sampleSpan<K>(tranedImg, ox0, cosa, oy0, -sina, re, y, xs, xe);
+    }
+    return re;
+}
+
+template <typename T>
+CImg<T> myrotate(CImg<T>& img, double angle) {
+    return myrotate<BilinearKernel>(img, angle);
+}
+
+// 对每一行做一维平移重采样：dst(x, y) = src(x + shift, y + dy)，其中shift = k * y + b
+// 同一行的平移量相同，两个线性插值权重在整行内不变；落在src外的部分为0
+// src与dst可以是不同的像素类型，第一次错切直接读原图，最后一次直接写结果图
+template <typename S, typename D>
+void shearRows(CImg<S> const &src, CImg<D> &dst, double k, double b, int dy) {
+    int ws = src.width(), wd = dst.width();
+    cimg_forC(dst, v) {
+#ifdef cimg_use_openmp
+#pragma omp parallel for
+#endif
+        for (int y = 0; y < dst.height(); y++) {
+            double shift = k * y + b;
+            int i0 = (int)std::floor(shift);
+            float f = (float)(shift - i0), g = 1 - f;
+            D *d = dst.data(0, y, 0, v);
+            const S *s = src.data(0, y + dy, 0, v) + i0;
+            std::fill(d, d + wd, (D)0);
+
+            // [lo, hi)内两个邻点都在src中，两端各有一个像素只有一个邻点
+            int lo = std::max(0, -i0), hi = std::min(wd, ws - 1 - i0);
+            for (int x = lo; x < hi; x++) storePixel(d[x], s[x] * g + s[x + 1] * f);
+            if (-i0 - 1 >= 0 && -i0 - 1 < wd) storePixel(d[-i0 - 1], s[-i0] * f);
+            if (ws - 1 - i0 >= 0 && ws - 1 - i0 < wd) storePixel(d[ws - 1 - i0], s[ws - 1 - i0] * g);
         }
-        
-        // 双线性插值
-        double color = bilinearInterpolation(tranedImg, point(ox, oy));
+    }
+}
 
-        re(x, y) = std::floor(color + 0.5);
+// 对每一列做一维平移重采样：dst(x, y) = src(x, y + shift)，其中shift = k * x + b
+// 按STRIP列一条分条处理，条内各列的平移量相近，读写的行片段都留在缓存中
+void shearColumns(CImg<float> const &src, CImg<float> &dst, double k, double b) {
+    const int STRIP = 64;
+    int hs = src.height(), hd = dst.height(), w = dst.width();
+    vector<int> i0(w);
+    vector<float> f(w);
+    for (int x = 0; x < w; x++) {
+        double shift = k * x + b;
+        i0[x] = (int)std::floor(shift);
+        f[x] = (float)(shift - i0[x]);
     }
+    dst.fill(0);
+    cimg_forC(dst, v) {
+#ifdef cimg_use_openmp
+#pragma omp parallel for
+#endif
+        for (int x0 = 0; x0 < w; x0 += STRIP) {
+            int x1 = std::min(x0 + STRIP, w);
+            int imin = *std::min_element(&i0[x0], &i0[0] + x1),
+                imax = *std::max_element(&i0[x0], &i0[0] + x1);
+            // 只处理条内至少有一列落在src中的行
+            int ylo = std::max(0, -imax - 1), yhi = std::min(hd, hs - imin);
+            const float *s = src.data(0, 0, 0, v);
+            long ws = src.width();
+            for (int y = ylo; y < yhi; y++) {
+                float *d = dst.data(0, y, 0, v);
+                if (y + imin >= 0 && y + imax + 1 < hs) {
+                    // 条内所有列的两个邻点都在src中
+                    for (int x = x0; x < x1; x++) {
+                        const float *p = s + (y + i0[x]) * ws + x;
+                        d[x] = p[0] * (1 - f[x]) + p[ws] * f[x];
+                    }
+                } else {
+                    for (int x = x0; x < x1; x++) {
+                        int sy = y + i0[x];
+                        float p0 = (sy >= 0 && sy < hs) ? s[sy * ws + x] : 0,
+                              p1 = (sy + 1 >= 0 && sy + 1 < hs) ? s[(sy + 1) * ws + x] : 0;
+                        d[x] = p0 * (1 - f[x]) + p1 * f[x];
+                    }
+                }
+            }
+        }
+    }
+}
+
+// 用三次错切(Paeth)旋转图片，angle为一平面角，结果的大小和位置与myrotate相同
+// 旋转矩阵分解为X(a)Y(b)X(a)，a = -tan(angle / 2)，b = sin(angle)，
+// 每次错切都是沿行或沿列的一维重采样，同一行(列)内插值权重不变，
+// 访存按行顺序或按列条进行，适合大于缓存的图像
+// 第一次错切直接读mytran的结果，最后一次直接写入结果图，中间只用两幅浮点图像交替
+template <typename T>
+CImg<T> myrotateShear(CImg<T>& img, double angle) {
+    unsigned int angle2 = (unsigned int)angle % 360;
+    CImg<T> tranedImg = mytran(img, angle2 / 90);
+    angle2 %= 90;
+    if (angle2 == 0) return tranedImg;
+
+    angle = angle2 + (angle - (unsigned int)angle);
+    angle = angle / 180 * cimg::PI;
+    double a = -std::tan(angle / 2), b = std::sin(angle);
+    int w0 = tranedImg.width(), h0 = tranedImg.height();
+    int nw = w0 * std::cos(angle) + h0 * b, nh = w0 * b + h0 * std::cos(angle);
+
+    // 以像素中心到图像中心的距离为坐标，dst中u处取src中u - a * v处
+    // 即src中的x = x' + (ws - wd) / 2 - a * (y + dy + 0.5 - hs / 2)
+    int c = tranedImg.spectrum();
+    int w1 = (int)std::ceil(w0 + fabs(a) * h0);
+    CImg<float> img1(w1, h0, 1, c);
+    shearRows(tranedImg, img1, -a, (w0 - w1) / 2.0 - a * (0.5 - h0 / 2.0), 0);
+    tranedImg.assign();
+
+    // Y方向错切，src中的y = y' + (hs - hd) / 2 - b * (x + 0.5 - w / 2)
+    int h2 = (int)std::ceil(h0 + b * w1);
+    CImg<float> img2(w1, h2, 1, c);
+    shearColumns(img1, img2, -b, (h0 - h2) / 2.0 - b * (0.5 - w1 / 2.0));
+    img1.assign();
+
+    // 最后一次X方向错切，直接裁剪到结果大小并转为原图的像素类型
+    CImg<T> re(nw, nh, 1, c);
+    int dy = (h2 - nh) / 2;
+    shearRows(img2, re, -a, (w1 - nw) / 2.0 - a * (dy + 0.5 - h2 / 2.0), dy);
     return re;
 }
 
+// 仿射变换的组合，rotate、scale、translate、crop依次累积到同一个矩阵中，
+// 最后由apply只重采样一次，避免每一步都分配新图像并重复插值
+// A为由原图坐标到结果坐标的前向矩阵[A0 A1 A2; A3 A4 A5]，w、h为当前画布大小
+struct AffineChain {
+    double A[6];
+    int w, h;
+
+    AffineChain(int w, int h) : w(w), h(h) {
+        A[0] = 1; A[1] = 0; A[2] = 0;
+        A[3] = 0; A[4] = 1; A[5] = 0;
+    }
+
+    // 左乘变换[t0 t1 t2; t3 t4 t5]
+    AffineChain &then(double t0, double t1, double t2, double t3, double t4, double t5) {
+        double B[6] = {t0 * A[0] + t1 * A[3], t0 * A[1] + t1 * A[4], t0 * A[2] + t1 * A[5] + t2,
+                       t3 * A[0] + t4 * A[3], t3 * A[1] + t4 * A[4], t3 * A[2] + t4 * A[5] + t5};
+        for (int i = 0; i < 6; i++) A[i] = B[i];
+        return *this;
+    }
+
+    // 绕画布中心顺时针旋转angle度，画布扩大为旋转后的包围盒，与myrotate一致
+    AffineChain &rotate(double angle) {
+        angle = angle / 180 * cimg::PI;
+        double c = std::cos(angle), s = std::sin(angle);
+        int nw = w * fabs(c) + h * fabs(s), nh = w * fabs(s) + h * fabs(c);
+        double cx = w / 2.0, cy = h / 2.0, ncx = nw / 2.0, ncy = nh / 2.0;
+        w = nw;
+        h = nh;
+        return then(c, -s, ncx - c * cx + s * cy, s, c, ncy - s * cx - c * cy);
+    }
+
+    // 缩放size倍，像素中心对齐，与myresize<K>一致
+    AffineChain &scale(double size) {
+        w = w * size;
+        h = h * size;
+        return then(size, 0, 0.5 * size - 0.5, 0, size, 0.5 * size - 0.5);
+    }
+
+    AffineChain &translate(double dx, double dy) {
+        return then(1, 0, dx, 0, 1, dy);
+    }
+
+    // 只保留画布中以(x0, y0)为左上角、大小为cw*ch的部分
+    AffineChain &crop(int x0, int y0, int cw, int ch) {
+        w = cw;
+        h = ch;
+        return then(1, 0, -x0, 0, 1, -y0);
+    }
+
+    // 用插值核K将组合后的变换作用于img，结果中没有对应原图的部分为0
+    // 原图像素(x, y)覆盖[x - 0.5, x + 0.5)，落在原图覆盖范围内的点都会被插值
+    template <class K, typename T>
+    CImg<T> apply(CImg<T> const &img) const {
+        CImg<T> re(std::max(w, 0), std::max(h, 0), 1, img.spectrum(), 0);
+        double det = A[0] * A[4] - A[1] * A[3];
+        if (re.is_empty() || fabs(det) < 1e-12) return re;
+
+        // 逆矩阵，由结果坐标映射回原图坐标
+        double M[6] = { A[4] / det, -A[1] / det, (A[1] * A[5] - A[4] * A[2]) / det,
+                       -A[3] / det,  A[0] / det, (A[3] * A[2] - A[0] * A[5]) / det};
+        cimg_forY(re, y) {
+            double ox0 = M[1] * y + M[2], oy0 = M[4] * y + M[5];
+            int xs, xe;
+            if (clipSpan(ox0 + 0.5, M[0], oy0 + 0.5, M[3], img.width(), img.height(), re.width(), xs, xe))
+                sampleSpan<K>(img, ox0, M[0], oy0, M[3], re, y, xs, xe);
+        }
+        return re;
+    }
+
+    template <typename T>
+    CImg<T> apply(CImg<T> const &img) const {
+        return apply<BilinearKernel>(img);
+    }
+};
+
 // 返回点p0到p1、p2所成直线的距离
 double dist(point p0, point p1, point p2) {
     return std::fabs((p2.y - p1.y) * p0.x + (p1.x - p2.x) * p0.y + \
@@ -454,51 +1218,1271 @@ double dist(pair<point, point> p) {
     return dist(p.first, p.second);
 }
 
-// 画出由p1 p2 p3三点确定的矩形（平行四边形），若不是矩形会有提示，bound为边宽
-void drawrectangle(CImg<unsigned char>& img, point p1, point p2, point p3, unsigned int bound) {
-    double d12 = dist(p1, p2), d13 = dist(p1, p3), d23 = dist(p2, p3);
+#ifdef cimg_use_jpeg
+// 用libjpeg在进程内解码JPEG文件，逐行解码后写入img的各通道，img原有空间大小合适时复用
+// scale为1、2、4、8时按1/scale解码，由libjpeg在反DCT时直接缩小，不需要先解码出全分辨率的图像
+// 只保留解码后x0 <= x <= x1、y0 <= y <= y1的部分，范围截断到图像内，返回时x0、y0为img左上角在解码结果中的位置
+// libjpeg-turbo下用jpeg_crop_scanline与jpeg_skip_scanlines跳过范围外的列和行，x0会向左对齐到解码块的边界；
+// 其余libjpeg逐行解码后只保留范围内的部分；解码完第y1行即停止
+// width、height不为空时写入原图(未缩小)的大小
+void loadJpeg(const char *filename, CImg<unsigned char> &img, int scale, int &x0, int &y0, int x1, int y1,
+              int *width = 0, int *height = 0) {
+    typedef CImg<unsigned char> Img;
+    struct jpeg_decompress_struct cinfo;
+    Img::_cimg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr.original);
+    jerr.original.error_exit = Img::_cimg_jpeg_error_exit;
+    std::FILE *file = cimg::fopen(filename, "rb");
+    vector<unsigned char> row;
+    if (setjmp(jerr.setjmp_buffer)) {
+        cimg::fclose(file);
+        throw CImgIOException("loadJpeg(): Error message returned by libjpeg: %s.", jerr.message);
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, file);
+    jpeg_read_header(&cinfo, TRUE);
+    if (width) *width = cinfo.image_width;
+    if (height) *height = cinfo.image_height;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = scale;
+    jpeg_start_decompress(&cinfo);
+    int c = cinfo.output_components;
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    // 截断后的右下角另存为xe、ye，参数x1、y1在setjmp之后不再修改，不会被longjmp破坏
+    int xe = std::min(x1, (int)cinfo.output_width - 1), ye = std::min(y1, (int)cinfo.output_height - 1);
+    if (x0 > xe || y0 > ye) {
+        img.assign();
+        jpeg_destroy_decompress(&cinfo);
+        cimg::fclose(file);
+        return;
+    }
+
+    // 解码出的每行为[ox, ox + ow)，其中只保留[x0, xe]
+    int ox = 0, ow = cinfo.output_width;
+#ifdef LIBJPEG_TURBO_VERSION
+    if (x0 > 0 || xe < ow - 1) {
+        JDIMENSION xoff = x0, width = xe - x0 + 1;
+        jpeg_crop_scanline(&cinfo, &xoff, &width);
+        ox = x0 = xoff;
+        ow = width;
+    }
+    if (y0 > 0) jpeg_skip_scanlines(&cinfo, y0);
+#endif
+    int w = xe - x0 + 1;
+    img.assign(w, ye - y0 + 1, 1, c);
+    row.resize(ow * c);
+    // 灰度图且不需要裁剪列时直接解码到img的行中，否则先解码到一行的交错缓冲区再拆分到各通道
+    bool direct = c == 1 && w == ow;
+    while ((int)cinfo.output_scanline <= ye) {
+        int y = cinfo.output_scanline;
+        JSAMPROW ptr = direct && y >= y0 ? img.data(0, y - y0) : &row[0];
+        if (jpeg_read_scanlines(&cinfo, &ptr, 1) != 1) break;
+        if (y < y0 || direct) continue;
+        for (int v = 0; v < c; v++) {
+            unsigned char *d = img.data(0, y - y0, 0, v);
+            const unsigned char *s = &row[(x0 - ox) * c + v];
+            for (int x = 0; x < w; x++, s += c) d[x] = *s;
+        }
+    }
+    if (cinfo.output_scanline == cinfo.output_height) jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    cimg::fclose(file);
+}
+
+void loadJpeg(const char *filename, CImg<unsigned char> &img, int scale = 1, int *width = 0, int *height = 0) {
+    int x0 = 0, y0 = 0;
+    loadJpeg(filename, img, scale, x0, y0, INT_MAX, INT_MAX, width, height);
+}
+#endif
+
+// 判断filename的扩展名是否为JPEG
+bool isJpeg(const char *filename) {
+    const char *ext = cimg::split_filename(filename);
+    return !cimg::strcasecmp(ext, "jpg") || !cimg::strcasecmp(ext, "jpeg");
+}
+
+// 读入图像文件到img中
+// 定义cimg_use_jpeg并链接libjpeg时，JPEG文件由loadJpeg在进程内解码，
+// 不再由CImg启动ImageMagick的convert转换为临时文件后读回；
+// 定义cimg_use_png并链接libpng时，PNG文件由CImg在进程内解码；其余情况交给CImg的load
+void loadImage(const char *filename, CImg<unsigned char> &img) {
+#ifdef cimg_use_jpeg
+    if (isJpeg(filename)) {
+        loadJpeg(filename, img);
+        return;
+    }
+#endif
+#ifdef cimg_use_png
+    if (!cimg::strcasecmp(cimg::split_filename(filename), "png")) {
+        img.load_png(filename);
+        return;
+    }
+#endif
+    img.load(filename);
+}
+
+// 读入图像，解码器能直接缩小时读入缩小为1/scale的图像(scale为1、2、4、8)，否则读入全图
+// 返回实际缩小的倍数：JPEG文件由libjpeg在反DCT时缩小，返回scale，其余格式返回1，由调用者自行缩小
+// width、height不为空时写入原图的大小，缩小后的大小向上取整，不能由img的大小乘以倍数得到
+int loadImageReduced(const char *filename, CImg<unsigned char> &img, int scale, int *width = 0, int *height = 0) {
+#ifdef cimg_use_jpeg
+    if (isJpeg(filename)) {
+        loadJpeg(filename, img, scale, width, height);
+        return scale;
+    }
+#else
+    cimg::unused(scale);
+#endif
+    loadImage(filename, img);
+    if (width) *width = img.width();
+    if (height) *height = img.height();
+    return 1;
+}
+
+// 读入缩小为1/scale的图像(scale为1、2、4、8)，用于只需要低分辨率图像的检测
+// JPEG文件由libjpeg在反DCT时直接缩小，其余格式读入全图后按面积平均缩小
+void loadImageScaled(const char *filename, CImg<unsigned char> &img, int scale) {
+    int reduced = loadImageReduced(filename, img, scale);
+    if (reduced < scale) img.resize(-100 * reduced / scale, -100 * reduced / scale, 1, -100, 2);
+}
+
+// 只读入原图中x0 <= x <= x1、y0 <= y <= y1的部分，返回时x0、y0为img左上角在原图中的位置
+// JPEG文件只解码到第y1行，libjpeg-turbo下还跳过范围外的行与列；其余格式读入全图后裁剪
+void loadImageRegion(const char *filename, CImg<unsigned char> &img, int &x0, int &y0, int x1, int y1) {
+#ifdef cimg_use_jpeg
+    if (isJpeg(filename)) {
+        loadJpeg(filename, img, 1, x0, y0, x1, y1);
+        return;
+    }
+#endif
+    loadImage(filename, img);
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    img.crop(x0, y0, std::min(x1, img.width() - 1), std::min(y1, img.height() - 1));
+}
+
+// 从src中取出x0 <= x <= x1、y0 <= y <= y1的部分放入img，与loadImageRegion相同，超出src的部分截去，
+// 返回时x0、y0为img左上角在src中的位置
+template <typename T>
+void cropRegion(CImg<T> const &src, CImg<T> &img, int &x0, int &y0, int x1, int y1) {
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    src.get_crop(x0, y0, std::min(x1, src.width() - 1), std::min(y1, src.height() - 1)).move_to(img);
+}
+
+// 通过管道从ffmpeg逐帧读入视频，不需要先把各帧保存为图像文件
+// ffmpeg把每帧编码为PPM写到管道中，next解析帧头后读入同一幅RGB图像中，大小不变时不重新分配
+// ffmpeg为ffmpeg程序的路径，fps大于0时先将视频抽帧为每秒fps帧
+struct VideoSource {
+    string filename;
+    int frames;                     // 已读入的帧数
+
+    VideoSource(string const &filename, double fps = 0, string const &ffmpeg = "ffmpeg")
+        : filename(filename), frames(0) {
+        char filter[64] = "";
+        if (fps > 0) std::sprintf(filter, " -vf fps=%g", fps);
+        string cmd = "\"" + ffmpeg + "\" -v error -nostdin -i \"" + filename + "\"" + filter +
+                     " -f image2pipe -vcodec ppm -";
+#if cimg_OS == 2
+        pipe = _popen(cmd.c_str(), "rb");
+#else
+        pipe = popen(cmd.c_str(), "r");
+#endif
+        if (!pipe) throw CImgIOException("VideoSource(): cannot run '%s'.", cmd.c_str());
+    }
+
+    ~VideoSource() {
+#if cimg_OS == 2
+        _pclose(pipe);
+#else
+        pclose(pipe);
+#endif
+    }
 
-    // 确保p2、p3在矩形中是相对的两点，同时确定是否是矩形
-    if (fabs(d12 * d12 + d13 * d13 - d23 * d23) >= EPS) {
-        if (fabs(d13 * d13 + d23 * d23 - d12 * d12) < EPS) {
-            std::swap(p1, p3);
-            std::swap(d12, d23);
-        } else if (fabs(d12 * d12 + d23 * d23 - d13 * d13) < EPS) {
-            std::swap(p1, p2);
-            std::swap(d13, d23);
+    // 读入下一帧，视频结束时返回false
+    bool next(CImg<unsigned char> &frame) {
+        int w, h, maxval;
+        if (std::fgetc(pipe) != 'P' || std::fgetc(pipe) != '6') return false;
+        if (!readNumber(w) || !readNumber(h) || !readNumber(maxval) || w <= 0 || h <= 0 || maxval > 255)
+            throw CImgIOException("VideoSource::next(): bad frame header in '%s'.", filename.c_str());
+        frame.assign(w, h, 1, 3);
+        row.resize(w * 3);
+        unsigned char *r = frame.data(0, 0, 0, 0), *g = frame.data(0, 0, 0, 1), *b = frame.data(0, 0, 0, 2);
+        for (int y = 0; y < h; y++) {
+            if (std::fread(&row[0], 1, row.size(), pipe) != row.size())
+                throw CImgIOException("VideoSource::next(): frame %d of '%s' is truncated.", frames, filename.c_str());
+            for (int x = 0; x < w; x++) {
+                *(r++) = row[3 * x];
+                *(g++) = row[3 * x + 1];
+                *(b++) = row[3 * x + 2];
+            }
+        }
+        frames++;
+        return true;
+    }
+
+private:
+    std::FILE *pipe;
+    vector<unsigned char> row;
+
+    VideoSource(VideoSource const &);
+    VideoSource &operator=(VideoSource const &);
+
+    // 读入帧头中的一个数，跳过之前的空白与注释，并读掉之后的一个空白字符
+    bool readNumber(int &v) {
+        int c = std::fgetc(pipe);
+        while (c == '#' || std::isspace(c)) {
+            if (c == '#') while (c != '\n' && c != EOF) c = std::fgetc(pipe);
+            c = std::fgetc(pipe);
+        }
+        if (!std::isdigit(c)) return false;
+        for (v = 0; std::isdigit(c); c = std::fgetc(pipe)) v = v * 10 + (c - '0');
+        return std::isspace(c) != 0;
+    }
+};
+
+// 检测的前端：求img每个像素各通道的模长，按factor*factor的块取平均缩小，再线性归一化到[0, 255]，
+// 相当于img.get_norm().resize(-100 / factor, -100 / factor, 1, 1, 2).normalize(0, 255)再转为8位
+// 只读一遍img，逐行同时读各通道并累加到缩小后的行中，同时记录最小值与最大值，最后转为8位时才做归一化
+template <typename T>
+CImg<unsigned char> normDownsample(CImg<T> const &img, int factor) {
+    int w = img.width() / factor, h = img.height() / factor, c = img.spectrum();
+    CImg<unsigned char> re(w, h, 1, 1);
+    if (re.is_empty()) return re;
+    vector<float> acc(w * h, 0.0f);
+    float inv = 1.0f / (factor * factor);
+    vector<const T *> row(c);
+    for (int y = 0; y < h * factor; y++) {
+        float *a = &acc[(y / factor) * w];
+        for (int v = 0; v < c; v++) row[v] = img.data(0, y, 0, v);
+        for (int x = 0; x < w * factor; x++) {
+            float sum = 0;
+            for (int v = 0; v < c; v++) sum += (float)row[v][x] * row[v][x];
+            a[x / factor] += std::sqrt(sum);
+        }
+    }
+
+    float m = acc[0] * inv, M = m;
+    for (int i = 0; i < w * h; i++) {
+        acc[i] *= inv;
+        m = std::min(m, acc[i]);
+        M = std::max(M, acc[i]);
+    }
+    if (M == m) return re.fill(0);
+    for (int i = 0; i < w * h; i++) re[i] = (unsigned char)((acc[i] - m) / (M - m) * 255);
+    return re;
+}
+
+// 批处理清单中的一项，cols为该行各列，键为列名，值为空的列不记录
+struct ManifestItem {
+    std::map<std::string, std::string> cols;
+
+    // 列name的值，未指定时返回def
+    std::string get(std::string const &name, std::string const &def = "") const {
+        std::map<std::string, std::string>::const_iterator it = cols.find(name);
+        return it == cols.end() ? def : it->second;
+    }
+
+    double getNumber(std::string const &name, double def) const {
+        std::string v = get(name);
+        return v.empty() ? def : std::atof(v.c_str());
+    }
+
+    // 列outputs中是否包含artifact，outputs为以逗号分隔的输出种类，未指定时生成全部输出
+    bool wants(std::string const &artifact) const {
+        std::string v = get("outputs");
+        if (v.empty()) return true;
+        return ("," + v + ",").find("," + artifact + ",") != std::string::npos;
+    }
+};
+
+// 读入TSV格式的批处理清单：第一行为列名，其后每行为一项，各列以制表符分隔
+// 空行与以#开头的行忽略，每行必须有input列，格式错误时抛出CImgIOException
+void readManifest(std::istream &in, std::vector<ManifestItem> &items) {
+    std::vector<std::string> header;
+    std::string line;
+    int lineno = 0;
+    while (std::getline(in, line)) {
+        lineno++;
+        if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        if (line.empty() || line[0] == '#') continue;
+
+        std::vector<std::string> fields;
+        for (std::string::size_type s = 0, e; ; s = e + 1) {
+            e = line.find('\t', s);
+            fields.push_back(line.substr(s, e == std::string::npos ? std::string::npos : e - s));
+            if (e == std::string::npos) break;
+        }
+        if (header.empty()) {
+            header = fields;
+            if (std::find(header.begin(), header.end(), "input") == header.end())
+                throw CImgIOException("readManifest(): header has no 'input' column.");
+            continue;
+        }
+        if (fields.size() > header.size())
+            throw CImgIOException("readManifest(): line %d has %d columns, header has %d.",
+                                  lineno, (int)fields.size(), (int)header.size());
+        ManifestItem item;
+        for (int i = 0; i < (int)fields.size(); i++)
+            if (!fields[i].empty()) item.cols[header[i]] = fields[i];
+        if (item.get("input").empty())
+            throw CImgIOException("readManifest(): line %d has no input.", lineno);
+        items.push_back(item);
+    }
+}
+
+// 解析"k/n"形式的分片参数，表示只处理序号除以n余k的项，格式错误时返回false
+bool parseShard(std::string const &s, int &k, int &n) {
+    return std::sscanf(s.c_str(), "%d/%d", &k, &n) == 2 && n > 0 && k >= 0 && k < n;
+}
+
+// 文件名中最后一个'/'或'\'之后的部分
+std::string baseName(std::string const &path) {
+    std::string::size_type p = path.find_last_of("/\\");
+    return p == std::string::npos ? path : path.substr(p + 1);
+}
+
+// 将目录dir与文件名file连接为路径，dir为空时返回file；使用'/'作分隔符，Windows下同样可用
+std::string joinPath(std::string const &dir, std::string const &file) {
+    if (dir.empty()) return file;
+    char last = dir[dir.size() - 1];
+    return last == '/' || last == '\\' ? dir + file : dir + "/" + file;
+}
+
+bool fileExists(std::string const &filename) {
+    std::FILE *f = std::fopen(filename.c_str(), "rb");
+    if (!f) return false;
+    std::fclose(f);
+    return true;
+}
+
+// 互斥量、条件变量与线程的简单封装，Windows下使用Win32 API(条件变量需要Vista及以上，即_WIN32_WINNT >= 0x0600)，
+// 其余系统使用pthread
+#if cimg_OS == 2
+struct Mutex {
+    CRITICAL_SECTION cs;
+    Mutex() { InitializeCriticalSection(&cs); }
+    ~Mutex() { DeleteCriticalSection(&cs); }
+    void lock() { EnterCriticalSection(&cs); }
+    void unlock() { LeaveCriticalSection(&cs); }
+};
+
+struct CondVar {
+    CONDITION_VARIABLE cv;
+    CondVar() { InitializeConditionVariable(&cv); }
+    void wait(Mutex &m) { SleepConditionVariableCS(&cv, &m.cs, INFINITE); }
+    void broadcast() { WakeAllConditionVariable(&cv); }
+};
+
+struct Thread {
+    void (*f)(void *);
+    void *arg;
+    HANDLE handle;
+    static DWORD WINAPI entry(LPVOID self) {
+        ((Thread *)self)->f(((Thread *)self)->arg);
+        return 0;
+    }
+    void start(void (*func)(void *), void *a) {
+        f = func;
+        arg = a;
+        handle = CreateThread(0, 0, entry, this, 0, 0);
+    }
+    void join() {
+        WaitForSingleObject(handle, INFINITE);
+        CloseHandle(handle);
+    }
+};
+#else
+struct Mutex {
+    pthread_mutex_t m;
+    Mutex() { pthread_mutex_init(&m, 0); }
+    ~Mutex() { pthread_mutex_destroy(&m); }
+    void lock() { pthread_mutex_lock(&m); }
+    void unlock() { pthread_mutex_unlock(&m); }
+};
+
+struct CondVar {
+    pthread_cond_t cv;
+    CondVar() { pthread_cond_init(&cv, 0); }
+    ~CondVar() { pthread_cond_destroy(&cv); }
+    void wait(Mutex &m) { pthread_cond_wait(&cv, &m.m); }
+    void broadcast() { pthread_cond_broadcast(&cv); }
+};
+
+struct Thread {
+    void (*f)(void *);
+    void *arg;
+    pthread_t handle;
+    static void *entry(void *self) {
+        ((Thread *)self)->f(((Thread *)self)->arg);
+        return 0;
+    }
+    void start(void (*func)(void *), void *a) {
+        f = func;
+        arg = a;
+        pthread_create(&handle, 0, entry, this);
+    }
+    void join() { pthread_join(handle, 0); }
+};
+#endif
+
+// 后台预读图像：threads个线程按names的顺序读入图像，next按原顺序依次取出
+// 每幅图像由loadImageReduced读入，能在解码时缩小的缩小为1/scale，其余为全图，next同时返回实际缩小的倍数与原图的大小
+// 已读入而未取出的图像最多depth幅，且总大小不超过maxBytes(至少允许一幅)，达到上限时读入线程等待
+// depth为0时不启动线程，next在调用时才读入
+// 读入失败时错误信息已由CImg输出，next返回的error为该信息，img为空，读入成功时error为空
+// streaming为true时可在之后用add继续加入文件，next在没有文件时等待，直到close后才返回false
+struct PrefetchLoader {
+    int scale, depth;
+    unsigned long maxBytes;
+
+    PrefetchLoader(vector<string> const &names, int scale, int depth, int threads, unsigned long maxBytes,
+                   bool streaming = false)
+        : scale(scale), depth(depth), maxBytes(maxBytes), names(names.begin(), names.end()), slots(names.size()),
+          issued(0), consumed(0), bytes(0), closed(!streaming), stopping(false),
+          workers(depth > 0 ? std::max(threads, 1) : 0) {
+        for (int i = 0; i < (int)workers.size(); i++) workers[i].start(work, this);
+    }
+
+    ~PrefetchLoader() {
+        mutex.lock();
+        stopping = true;
+        changed.broadcast();
+        mutex.unlock();
+        for (int i = 0; i < (int)workers.size(); i++) workers[i].join();
+    }
+
+    // 在末尾加入一个文件
+    void add(string const &name) {
+        mutex.lock();
+        names.push_back(name);
+        slots.push_back(Slot());
+        changed.broadcast();
+        mutex.unlock();
+    }
+
+    // 不再加入文件，取完已加入的文件后next返回false
+    void close() {
+        mutex.lock();
+        closed = true;
+        changed.broadcast();
+        mutex.unlock();
+    }
+
+    // 取出下一幅图像放入img中，name为其文件名，reduced为img已缩小的倍数，width、height为原图的大小，
+    // error为读入失败时的错误信息，全部取完时返回false
+    bool next(CImg<unsigned char> &img, string &name, int &reduced, int &width, int &height, string &error) {
+        mutex.lock();
+        while (names.empty() && !closed) changed.wait(mutex);
+        if (names.empty()) {
+            mutex.unlock();
+            return false;
+        }
+        name = names.front();
+        if (workers.empty()) {
+            names.pop_front();
+            slots.pop_front();
+            consumed++;
+            mutex.unlock();
+            error.clear();
+            reduced = 1;
+            width = height = 0;
+            try {
+                reduced = loadImageReduced(name.c_str(), img, scale, &width, &height);
+            } catch (CImgException &e) {
+                img.assign();
+                error = e.what();
+            }
+            return true;
+        }
+
+        // deque在两端加入删除时不会使其余元素的引用失效
+        Slot &s = slots.front();
+        while (!s.ready) changed.wait(mutex);
+        img.swap(s.img);
+        reduced = s.reduced;
+        width = s.width;
+        height = s.height;
+        error = s.error;
+        bytes -= s.bytes;
+        names.pop_front();
+        slots.pop_front();
+        consumed++;
+        changed.broadcast();
+        mutex.unlock();
+        return true;
+    }
+
+private:
+    struct Slot {
+        CImg<unsigned char> img;
+        string error;
+        unsigned long bytes;
+        int reduced, width, height;
+        bool ready;
+        Slot() : bytes(0), reduced(1), width(0), height(0), ready(false) {}
+    };
+
+    // names与slots中只保存未取出的文件，第i个文件位于第i - consumed项
+    deque<string> names;
+    deque<Slot> slots;
+    int issued, consumed;           // 已开始读入的个数与已取出的个数
+    unsigned long bytes;            // 已读入而未取出的图像总大小
+    bool closed, stopping;
+    Mutex mutex;
+    CondVar changed;
+    vector<Thread> workers;
+
+    // 读入线程：在深度与内存允许时领取下一个文件，读入后放入对应的位置
+    static void work(void *self) {
+        PrefetchLoader &p = *(PrefetchLoader *)self;
+        p.mutex.lock();
+        for (;;) {
+            int ahead = p.issued - p.consumed;
+            bool pending = ahead < (int)p.names.size(),
+                 full = ahead >= p.depth || (p.bytes >= p.maxBytes && ahead > 0);
+            if (p.stopping || (!pending && p.closed)) break;
+            if (!pending || full) {
+                p.changed.wait(p.mutex);
+                continue;
+            }
+            int i = p.issued++;
+            string name = p.names[i - p.consumed];
+            p.mutex.unlock();
+
+            CImg<unsigned char> img;
+            string error;
+            int reduced = 1, width = 0, height = 0;
+            try {
+                reduced = loadImageReduced(name.c_str(), img, p.scale, &width, &height);
+            } catch (CImgException &e) {
+                img.assign();
+                error = e.what();
+            }
+
+            // 第i个文件读好之前不会被取出，此时仍在slots中
+            p.mutex.lock();
+            Slot &s = p.slots[i - p.consumed];
+            img.swap(s.img);
+            s.error = error;
+            s.reduced = reduced;
+            s.width = width;
+            s.height = height;
+            s.bytes = s.img.size();
+            s.ready = true;
+            p.bytes += s.bytes;
+            p.changed.broadcast();
+        }
+        p.mutex.unlock();
+    }
+};
+
+// 后台写出的任务，run在写出线程中执行
+struct WriteJob {
+    virtual ~WriteJob() {}
+    virtual void run() = 0;
+};
+
+// 按文件扩展名编码并保存图像
+template <typename T>
+struct SaveJob : WriteJob {
+    CImg<T> img;
+    string filename;
+    void run() { img.save(filename.c_str()); }
+};
+
+// 将src中的四边形映射为w*h的图像并写为JPEG，见projectiveMappingToJpeg
+template <typename T>
+struct MappingJob : WriteJob {
+    CImg<T> src;
+    int w, h;
+    point sPoints[4], dPoints[4];
+    string filename;
+    void run() { projectiveMappingToJpeg(src, w, h, sPoints, dPoints, filename.c_str()); }
+};
+
+// 后台写出图像：threads个线程依次取出任务编码并写入文件，调用者不必等待写完即可处理下一幅图像
+// 排队中的任务最多depth个，已满时submit等待，避免处理快于写出时占用的内存不断增长
+// threads为0时submit直接在调用线程中写出
+// 写出失败时错误信息由CImg输出，只记录失败的任务数，由flush返回
+struct ImageWriter {
+    ImageWriter(int threads, int depth)
+        : depth(std::max(depth, 1)), running(0), failures(0), stopping(false), workers(std::max(threads, 0)) {
+        for (int i = 0; i < (int)workers.size(); i++) workers[i].start(work, this);
+    }
+
+    ~ImageWriter() {
+        mutex.lock();
+        while (!queue.empty() || running) changed.wait(mutex);
+        stopping = true;
+        changed.broadcast();
+        mutex.unlock();
+        for (int i = 0; i < (int)workers.size(); i++) workers[i].join();
+    }
+
+    // 提交任务，job由ImageWriter负责释放
+    void submit(WriteJob *job) {
+        if (workers.empty()) {
+            runJob(job);
+            return;
+        }
+        mutex.lock();
+        while ((int)queue.size() >= depth) changed.wait(mutex);
+        queue.push_back(job);
+        changed.broadcast();
+        mutex.unlock();
+    }
+
+    // 保存img到filename，img的数据交给写出线程，调用后img为空
+    template <typename T>
+    void save(CImg<T> &img, string const &filename) {
+        SaveJob<T> *job = new SaveJob<T>;
+        img.swap(job->img);
+        job->filename = filename;
+        submit(job);
+    }
+
+    // 将src中的四边形映射后写为JPEG，src的数据交给写出线程，调用后src为空
+    template <typename T>
+    void saveMapping(CImg<T> &src, int w, int h, point const *sPoints, point const *dPoints, string const &filename) {
+        MappingJob<T> *job = new MappingJob<T>;
+        src.swap(job->src);
+        job->w = w;
+        job->h = h;
+        std::copy(sPoints, sPoints + 4, job->sPoints);
+        std::copy(dPoints, dPoints + 4, job->dPoints);
+        job->filename = filename;
+        submit(job);
+    }
+
+    // 等待已提交的任务全部写完，返回上次flush以来失败的任务数
+    int flush() {
+        mutex.lock();
+        while (!queue.empty() || running) changed.wait(mutex);
+        int n = failures;
+        failures = 0;
+        mutex.unlock();
+        return n;
+    }
+
+private:
+    int depth, running;             // running为正在写出的任务数
+    int failures;                   // 写出失败的任务数
+    bool stopping;
+    list<WriteJob *> queue;
+    Mutex mutex;
+    CondVar changed;
+    vector<Thread> workers;
+
+    // 执行并释放job，失败时计数
+    void runJob(WriteJob *job) {
+        bool ok = true;
+        try {
+            job->run();
+        } catch (CImgException &) {
+            ok = false;
+        }
+        delete job;
+        if (ok) return;
+        mutex.lock();
+        failures++;
+        mutex.unlock();
+    }
+
+    static void work(void *self) {
+        ImageWriter &w = *(ImageWriter *)self;
+        w.mutex.lock();
+        for (;;) {
+            while (!w.stopping && w.queue.empty()) w.changed.wait(w.mutex);
+            if (w.queue.empty()) break;
+            WriteJob *job = w.queue.front();
+            w.queue.pop_front();
+            w.running++;
+            w.changed.broadcast();
+            w.mutex.unlock();
+
+            w.runJob(job);
+
+            w.mutex.lock();
+            w.running--;
+            w.changed.broadcast();
+        }
+        w.mutex.unlock();
+    }
+};
+
+// 监视目录dir，next依次返回其中新写完的文件的路径，启动前已在目录中的文件不返回
+// Linux下使用inotify，文件写完关闭(IN_CLOSE_WRITE)或移入目录(IN_MOVED_TO)时即返回
+// 其余系统每隔interval毫秒扫描一次目录，新文件的大小在两次扫描之间不变时视为已写完
+struct DirWatcher {
+    string dir;
+
+    DirWatcher(string const &dir, int interval = 1000) : dir(dir), interval(interval) {
+#ifdef __linux__
+        fd = inotify_init();
+        if (fd < 0 || inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+            throw CImgIOException("DirWatcher(): cannot watch directory '%s'.", dir.c_str());
+#else
+        if (!cimg::is_directory(dir.c_str()))
+            throw CImgIOException("DirWatcher(): cannot watch directory '%s'.", dir.c_str());
+        CImgList<char> files = cimg::files(dir.c_str(), false, 0, false);
+        cimglist_for(files, i) sizes[files[i]._data] = -1;
+#endif
+    }
+
+    ~DirWatcher() {
+#ifdef __linux__
+        ::close(fd);
+#endif
+    }
+
+    // 等待下一个新文件
+    string next() {
+        while (ready.empty()) poll();
+        string name = ready.front();
+        ready.pop_front();
+        return name;
+    }
+
+private:
+    int interval;
+    list<string> ready;             // 已写完而未返回的文件
+#ifdef __linux__
+    int fd;
+
+    // 读入一批事件，没有事件时阻塞
+    void poll() {
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len <= 0) throw CImgIOException("DirWatcher::next(): cannot read events of '%s'.", dir.c_str());
+        for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            struct inotify_event const *e = (struct inotify_event *)p;
+            if (e->len && !(e->mask & IN_ISDIR)) ready.push_back(joinPath(dir, e->name));
+        }
+    }
+#else
+    map<string, long> sizes;        // 上次扫描时各文件的大小，已返回的文件记为-1
+
+    long fileSize(string const &name) {
+        std::FILE *f = std::fopen(name.c_str(), "rb");
+        if (!f) return -2;
+        std::fseek(f, 0, SEEK_END);
+        long size = std::ftell(f);
+        std::fclose(f);
+        return size;
+    }
+
+    // 扫描一次目录
+    void poll() {
+        cimg::sleep(interval);
+        CImgList<char> files = cimg::files(dir.c_str(), false, 0, false);
+        cimglist_for(files, i) {
+            string name = files[i]._data;
+            map<string, long>::iterator it = sizes.find(name);
+            if (it != sizes.end() && it->second == -1) continue;
+            long size = fileSize(joinPath(dir, name));
+            if (size < 0) continue;
+            if (it != sizes.end() && it->second == size) {
+                ready.push_back(joinPath(dir, name));
+                it->second = -1;
+            } else {
+                sizes[name] = size;
+            }
+        }
+    }
+#endif
+};
+
+// 一幅图像的检测结果，坐标均为原图中的像素坐标
+struct Detection {
+    string input;
+    int frame;                      // 视频中的帧序号，从0开始，不是视频时为-1
+    vector<point> lines;            // 检测出的直线(theta, rho)，rho为直线到原图中心的距离
+    vector<double> scores;          // 各直线的得分，见getLinesFromVote
+    vector<point> corners;          // 直线的交点中构成四边形的角点
+    bool found;                     // 是否找到四边形
+    point quad[4];                  // 选定的四边形，顺序为top-left, top-right, bot-right, bot-left
+    int outw, outh;                 // 矫正输出的大小
+    Detection() : frame(-1), found(false), outw(0), outh(0) {}
+};
+
+// 逐幅记录检测结果，filename以.csv结尾时为CSV格式，否则为JSON Lines格式，每幅图像一行：
+// {"input":"1.jpg","lines":[{"theta":0.01,"rho":812,"score":201}, ...],"corners":[[x,y], ...],
+//  "quad":[[x,y], ...],"output":[w,h]}，未找到四边形时quad与output为null，视频中的帧在input后还有"frame":序号
+// CSV中每行为一个值，列为input,type,index,x,y,score,frame，type为line(x、y为theta、rho)、corner、quad或
+// output(x、y为宽、高)，不是视频时frame为空
+// 每幅图像写完即刷新，监视模式下可随时读取
+struct DetectionLog {
+    DetectionLog(string const &filename) : csv(false), file(0) {
+        csv = filename.size() >= 4 && cimg::strcasecmp(filename.c_str() + filename.size() - 4, ".csv") == 0;
+        file = cimg::fopen(filename.c_str(), "w");
+        if (csv) std::fprintf(file, "input,type,index,x,y,score,frame\n");
+    }
+
+    ~DetectionLog() { cimg::fclose(file); }
+
+    void write(Detection const &d) {
+        if (csv) writeCsv(d);
+        else writeJson(d);
+        std::fflush(file);
+    }
+
+private:
+    bool csv;
+    std::FILE *file;
+
+    DetectionLog(DetectionLog const &);
+    DetectionLog &operator=(DetectionLog const &);
+
+    void writeJson(Detection const &d) {
+        std::fprintf(file, "{\"input\":\"");
+        for (int i = 0; i < (int)d.input.size(); i++) {
+            unsigned char c = d.input[i];
+            if (c == '"' || c == '\\') std::fprintf(file, "\\%c", c);
+            else if (c < 0x20) std::fprintf(file, "\\u%04x", c);
+            else std::fputc(c, file);
+        }
+        std::fprintf(file, "\"");
+        if (d.frame >= 0) std::fprintf(file, ",\"frame\":%d", d.frame);
+        std::fprintf(file, ",\"lines\":[");
+        for (int i = 0; i < (int)d.lines.size(); i++)
+            std::fprintf(file, "%s{\"theta\":%.6g,\"rho\":%.6g,\"score\":%.6g}", i ? "," : "",
+                         d.lines[i].x, d.lines[i].y, i < (int)d.scores.size() ? d.scores[i] : 0.0);
+        std::fprintf(file, "],\"corners\":[");
+        for (int i = 0; i < (int)d.corners.size(); i++)
+            std::fprintf(file, "%s[%.6g,%.6g]", i ? "," : "", d.corners[i].x, d.corners[i].y);
+        if (d.found) {
+            std::fprintf(file, "],\"quad\":[");
+            for (int i = 0; i < 4; i++) std::fprintf(file, "%s[%.6g,%.6g]", i ? "," : "", d.quad[i].x, d.quad[i].y);
+            std::fprintf(file, "],\"output\":[%d,%d]}\n", d.outw, d.outh);
         } else {
-            std::cout << "WARRANTY: Not a rectangle.\n";
+            std::fprintf(file, "],\"quad\":null,\"output\":null}\n");
         }
     }
 
-    // 类似画直角三角形，根据对称性画出矩形（平行四边形）
-    unsigned int mx = p2.x + p3.x, my = p2.y + p3.y;
-    cimg_forXY(img, x, y) {
-        point p0(x, y);
-        if (  (dist(p0, p1, p2) < bound / 2 && dist(p0, p1) + dist(p0, p2) < d12 + bound)
-           || (dist(p0, p1, p3) < bound / 2 && dist(p0, p1) + dist(p0, p3) < d13 + bound)) {
-            img(p0.x, p0.y) = 0;
-            img(mx - p0.x, my - p0.y) = 0;
+    void writeCsv(Detection const &d) {
+        // 含逗号、引号或换行的文件名用引号括起，其中的引号写两次
+        string name = d.input;
+        if (name.find_first_of(",\"\n") != string::npos) {
+            for (string::size_type p = 0; (p = name.find('"', p)) != string::npos; p += 2) name.insert(p, "\"");
+            name = "\"" + name + "\"";
         }
+        const char *n = name.c_str();
+        char f[16] = "";
+        if (d.frame >= 0) std::sprintf(f, "%d", d.frame);
+        for (int i = 0; i < (int)d.lines.size(); i++)
+            std::fprintf(file, "%s,line,%d,%.6g,%.6g,%.6g,%s\n", n, i, d.lines[i].x, d.lines[i].y,
+                         i < (int)d.scores.size() ? d.scores[i] : 0.0, f);
+        for (int i = 0; i < (int)d.corners.size(); i++)
+            std::fprintf(file, "%s,corner,%d,%.6g,%.6g,,%s\n", n, i, d.corners[i].x, d.corners[i].y, f);
+        if (!d.found) return;
+        for (int i = 0; i < 4; i++)
+            std::fprintf(file, "%s,quad,%d,%.6g,%.6g,,%s\n", n, i, d.quad[i].x, d.quad[i].y, f);
+        std::fprintf(file, "%s,output,0,%d,%d,,%s\n", n, d.outw, d.outh, f);
     }
+};
+
+// 在w*h的范围内截取直线(theta, rho)，直线方程为(x - w/2)cos(theta) + (y - h/2)sin(theta) = rho，与getHough一致
+// 结果为直线与边界的两个交点a、b，直线不经过该范围时返回false
+bool clipHoughLine(double theta, double rho, double w, double h, point &a, point &b) {
+    double c = cos(theta), s = sin(theta),
+           x0 = w / 2 + rho * c, y0 = h / 2 + rho * s;     // 直线上离中心最近的点，方向为(-s, c)
+    double t0 = -(w + h), t1 = w + h;
+    double dir[2] = { -s, c }, p[2] = { x0, y0 }, lim[2] = { w, h };
+    for (int k = 0; k < 2; k++) {
+        if (fabs(dir[k]) < EPS) {
+            if (p[k] < 0 || p[k] > lim[k]) return false;
+            continue;
+        }
+        double ta = (0 - p[k]) / dir[k], tb = (lim[k] - p[k]) / dir[k];
+        t0 = std::max(t0, std::min(ta, tb));
+        t1 = std::min(t1, std::max(ta, tb));
+    }
+    if (t0 >= t1) return false;
+    a = point(x0 - s * t0, y0 + c * t0);
+    b = point(x0 - s * t1, y0 + c * t1);
+    return true;
 }
 
-// 画出由p1 p2 p3三点确定的三角形，bound为边宽
-void drawreiangle(CImg<unsigned char>& img, point p1, point p2, point p3, unsigned int bound) {
+// 将检测结果写为SVG覆盖层：以href引用w*h的原图为底，画出检测出的直线、选定的四边形与角点
+// 只有几KB的矢量路径，不需要在原图上绘制再重新编码
+void writeOverlaySvg(string const &filename, string const &href, int w, int h, Detection const &d) {
+    string ref;
+    for (int i = 0; i < (int)href.size(); i++) {
+        char c = href[i];
+        if (c == '&') ref += "&amp;";
+        else if (c == '<') ref += "&lt;";
+        else if (c == '"') ref += "&quot;";
+        else if (c == '\\') ref += '/';
+        else ref += c;
+    }
+    double sw = std::max(w, h) / 500.0;    // 线宽随图像大小变化，缩放查看时粗细相当
+    std::FILE *file = cimg::fopen(filename.c_str(), "w");
+    std::fprintf(file, "<svg xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\" "
+                       "width=\"%d\" height=\"%d\" viewBox=\"0 0 %d %d\">\n", w, h, w, h);
+    std::fprintf(file, "<image xlink:href=\"%s\" x=\"0\" y=\"0\" width=\"%d\" height=\"%d\"/>\n", ref.c_str(), w, h);
+    std::fprintf(file, "<g stroke=\"#ffff00\" stroke-opacity=\"0.6\" stroke-width=\"%.3g\">\n", sw);
+    for (int i = 0; i < (int)d.lines.size(); i++) {
+        point a, b;
+        if (clipHoughLine(d.lines[i].x, d.lines[i].y, w, h, a, b))
+            std::fprintf(file, "<line x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\"/>\n", a.x, a.y, b.x, b.y);
+    }
+    std::fprintf(file, "</g>\n");
+    if (d.found) {
+        std::fprintf(file, "<polygon fill=\"none\" stroke=\"#0040ff\" stroke-width=\"%.3g\" points=\"", 3 * sw);
+        for (int i = 0; i < 4; i++) std::fprintf(file, "%s%.1f,%.1f", i ? " " : "", d.quad[i].x, d.quad[i].y);
+        std::fprintf(file, "\"/>\n");
+    }
+    std::fprintf(file, "<g fill=\"#ff0000\">\n");
+    for (int i = 0; i < (int)d.corners.size(); i++)
+        std::fprintf(file, "<circle cx=\"%.1f\" cy=\"%.1f\" r=\"%.3g\"/>\n", d.corners[i].x, d.corners[i].y, 4 * sw);
+    std::fprintf(file, "</g>\n</svg>\n");
+    cimg::fclose(file);
+}
+
+// 矫正输出的分辨率策略
+// TARGET_DPI:     把四边形视为A4纸(297mm*210mm)，按给定DPI确定画布，254DPI即2970*2100
+// MATCH_SOURCE:   画布边长取四边形对边长度的较大值，与原图的像素密度相当
+// MAX_MEGAPIXELS: 同MATCH_SOURCE，但总像素数不超过给定的百万像素数
+enum ResolutionPolicy { TARGET_DPI, MATCH_SOURCE, MAX_MEGAPIXELS };
+
+// 由arrangePoint排好序的四个角点计算输出画布的宽w和高h，byx为arrangePoint的返回值
+void getOutputSize(point *P, bool byx, ResolutionPolicy policy, double value, int &w, int &h) {
+    if (policy == TARGET_DPI) {
+        w = (int)(value * 210 / 25.4 + 0.5);
+        h = (int)(value * 297 / 25.4 + 0.5);
+        if (byx) std::swap(w, h);
+    } else {
+        double sw = std::max(dist(P[0], P[1]), dist(P[3], P[2])),
+               sh = std::max(dist(P[0], P[3]), dist(P[1], P[2]));
+        if (policy == MAX_MEGAPIXELS && sw * sh > value * 1e6) {
+            double k = sqrt(value * 1e6 / (sw * sh));
+            sw *= k;
+            sh *= k;
+        }
+        w = (int)(sw + 0.5);
+        h = (int)(sh + 0.5);
+    }
+    w = std::max(w, 1);
+    h = std::max(h, 1);
+}
+
+// 将第y行[xs, xe]内的像素置为color，color[v]为第v个通道的值，区间先截断到图像内
+template <typename T>
+void fillSpan(CImg<T>& img, int y, int xs, int xe, T const *color) {
+    if (y < 0 || y >= img.height()) return;
+    xs = std::max(xs, 0);
+    xe = std::min(xe, img.width() - 1);
+    if (xs > xe) return;
+    cimg_forC(img, v) std::fill(img.data(xs, y, 0, v), img.data(xe, y, 0, v) + 1, color[v]);
+}
+
+// 图像中x0 <= x <= x1、y0 <= y <= y1的矩形区域，用于把绘制限制在图像的一块内
+struct ClipRect {
+    int x0, y0, x1, y1;
+    ClipRect(int x0, int y0, int x1, int y1) : x0(x0), y0(y0), x1(x1), y1(y1) {}
+    template <typename T>
+    ClipRect(CImg<T> const &img) : x0(0), y0(0), x1(img.width() - 1), y1(img.height() - 1) {}
+};
+
+// 凸多边形P[0]...P[n - 1]的走向，逆时针(y轴向下时为顺时针)为1，反之为-1，退化为线段或点时为0
+double polygonOrientation(point const *P, int n) {
+    double area = 0;
+    for (int i = 0; i < n; i++) area += P[i].x * P[(i + 1) % n].y - P[(i + 1) % n].x * P[i].y;
+    return fabs(area) < EPS ? 0 : (area > 0 ? 1 : -1);
+}
+
+// 将[lo, hi]缩小为与凸多边形P在第y行上的区间的交集，s为P的走向，返回false表示交集为空
+// 每条边所在的半平面在一行内是对x的一个线性约束，内侧满足s * ((b - a) x (p - a)) >= 0，整理为A * x + B >= 0
+bool convexSpan(point const *P, int n, double s, double y, double &lo, double &hi) {
+    for (int i = 0; i < n; i++) {
+        point const &a = P[i], &b = P[(i + 1) % n];
+        double A = -s * (b.y - a.y), B = s * ((b.x - a.x) * (y - a.y) + (b.y - a.y) * a.x);
+        if (fabs(A) < 1e-12) {
+            if (B < 0) return false;
+        } else if (A > 0) {
+            lo = std::max(lo, -B / A);
+        } else {
+            hi = std::min(hi, -B / A);
+        }
+    }
+    return lo <= hi;
+}
+
+// 扫描转换凸多边形P[0]...P[n - 1]，填充像素中心落在多边形内的像素
+// 逐行由convexSpan求出填充区间，只访问多边形包围盒与clip相交部分内的行
+template <typename T>
+void fillConvexPolygon(CImg<T>& img, point const *P, int n, T const *color, ClipRect const &clip) {
+    double s = polygonOrientation(P, n), ymin = P[0].y, ymax = P[0].y;
+    if (s == 0) return;
+    for (int i = 1; i < n; i++) {
+        ymin = std::min(ymin, P[i].y);
+        ymax = std::max(ymax, P[i].y);
+    }
+
+    int ys = std::max(clip.y0, (int)std::ceil(ymin)), ye = std::min(clip.y1, (int)std::floor(ymax));
+    for (int y = ys; y <= ye; y++) {
+        double lo = clip.x0, hi = clip.x1;
+        if (convexSpan(P, n, s, y, lo, hi)) fillSpan(img, y, (int)std::ceil(lo), (int)std::floor(hi), color);
+    }
+}
+
+template <typename T>
+void fillConvexPolygon(CImg<T>& img, point const *P, int n, T color) {
+    std::vector<T> c(img.spectrum(), color);
+    fillConvexPolygon(img, P, n, &c[0], ClipRect(img));
+}
+
+// p1、p2间宽为width的线段所占的矩形，以线段为中轴、两端各延长width / 2，四个角点写入Q
+void thickLineQuad(point p1, point p2, double width, point *Q) {
+    double d = dist(p1, p2), hw = width / 2;
+    // 沿线段方向的半宽向量(ux, uy)及其法向(-uy, ux)
+    double ux = d < EPS ? hw : (p2.x - p1.x) / d * hw, uy = d < EPS ? 0 : (p2.y - p1.y) / d * hw;
+    Q[0] = point(p1.x - ux - uy, p1.y - uy + ux);
+    Q[1] = point(p2.x + ux - uy, p2.y + uy + ux);
+    Q[2] = point(p2.x + ux + uy, p2.y + uy - ux);
+    Q[3] = point(p1.x - ux + uy, p1.y - uy - ux);
+}
+
+// 画出p1、p2间宽为width的线段
+template <typename T>
+void drawThickLine(CImg<T>& img, point p1, point p2, double width, T const *color, ClipRect const &clip) {
+    point Q[4];
+    thickLineQuad(p1, p2, width, Q);
+    fillConvexPolygon(img, Q, 4, color, clip);
+}
+
+template <typename T>
+void drawThickLine(CImg<T>& img, point p1, point p2, double width, T color) {
+    std::vector<T> c(img.spectrum(), color);
+    drawThickLine(img, p1, p2, width, &c[0], ClipRect(img));
+}
+
+// 画出p1、p2间宽为width的抗锯齿线段，线段两端为半圆
+// 像素到线段的距离减去width / 2即为到线段边界的有向距离sd，像素的覆盖率取0.5 - sd并截断到[0, 1]，
+// 按覆盖率乘以opacity与原像素混合；只访问外扩半个像素的线段所在矩形内的像素，每个像素只写一次
+template <typename T>
+void drawSmoothLine(CImg<T>& img, point p1, point p2, double width, T const *color, ClipRect const &clip,
+                    double opacity = 1) {
+    double hw = width / 2, dx = p2.x - p1.x, dy = p2.y - p1.y, len2 = dx * dx + dy * dy;
+    double inner = hw > 0.5 ? (hw - 0.5) * (hw - 0.5) : -1, outer = (hw + 0.5) * (hw + 0.5);
+    point Q[4];
+    thickLineQuad(p1, p2, width + 1, Q);
+    double s = polygonOrientation(Q, 4);
+    int ys = std::max(clip.y0, (int)std::ceil(std::min(std::min(Q[0].y, Q[1].y), std::min(Q[2].y, Q[3].y)))),
+        ye = std::min(clip.y1, (int)std::floor(std::max(std::max(Q[0].y, Q[1].y), std::max(Q[2].y, Q[3].y))));
+    for (int y = ys; y <= ye; y++) {
+        double lo = clip.x0, hi = clip.x1;
+        if (!convexSpan(Q, 4, s, y, lo, hi)) continue;
+        int xs = std::max((int)std::ceil(lo), 0), xe = std::min((int)std::floor(hi), img.width() - 1);
+        for (int x = xs; x <= xe; x++) {
+            // 到线段的距离的平方，t为垂足在线段上的位置
+            double px = x - p1.x, py = y - p1.y;
+            double t = len2 < EPS ? 0 : std::max(0.0, std::min(1.0, (px * dx + py * dy) / len2));
+            double ex = px - t * dx, ey = py - t * dy, d2 = ex * ex + ey * ey;
+            if (d2 >= outer) continue;
+            double a = d2 <= inner ? opacity : std::min(1.0, hw + 0.5 - std::sqrt(d2)) * opacity;
+            cimg_forC(img, v) {
+                T &p = img(x, y, 0, v);
+                storePixel(p, p + (color[v] - (double)p) * a);
+            }
+        }
+    }
+}
+
+template <typename T>
+void drawSmoothLine(CImg<T>& img, point p1, point p2, double width, T color, double opacity = 1) {
+    std::vector<T> c(img.spectrum(), color);
+    drawSmoothLine(img, p1, p2, width, &c[0], ClipRect(img), opacity);
+}
+
+// 画出以c为圆心、r为半径、宽为width的圆环，即满足|dist(p, c) - r| < width / 2的像素
+// 逐行由内外两个圆求出至多两段填充区间，每行至多开两次方
+template <typename T>
+void drawRing(CImg<T>& img, point c, double r, double width, T const *color, ClipRect const &clip) {
+    double ro = r + width / 2, ri = r - width / 2;
+    int ys = std::max(clip.y0, (int)std::floor(c.y - ro)), ye = std::min(clip.y1, (int)std::ceil(c.y + ro));
+    for (int y = ys; y <= ye; y++) {
+        double dy2 = (y - c.y) * (y - c.y), so2 = ro * ro - dy2;
+        if (so2 <= 0) continue;
+        double so = std::sqrt(so2);
+        int xs = std::max(clip.x0, (int)std::floor(c.x - so) + 1),
+            xe = std::min(clip.x1, (int)std::ceil(c.x + so) - 1);
+        double si2 = ri > 0 ? ri * ri - dy2 : -1;
+        if (si2 < 0) {
+            fillSpan(img, y, xs, xe, color);
+        } else {
+            // 内圆上及内圆中的像素不画
+            double si = std::sqrt(si2);
+            fillSpan(img, y, xs, std::min(xe, (int)std::ceil(c.x - si) - 1), color);
+            fillSpan(img, y, std::max(xs, (int)std::floor(c.x + si) + 1), xe, color);
+        }
+    }
+}
+
+template <typename T>
+void drawRing(CImg<T>& img, point c, double r, double width, T color) {
+    std::vector<T> cl(img.spectrum(), color);
+    drawRing(img, c, r, width, &cl[0], ClipRect(img));
+}
+
+// 绘制命令列表，先记录所有线段、凸多边形和圆环，最后由render一次画到图像上
+// render把图像分为tile*tile的块，将每个图形登记到其包围盒覆盖的块中，再逐块只画登记在该块中的图形，
+// 每块只被访问一次，块之间互不重叠，可以并行；同一块内按记录的顺序绘制，后记录的图形在上层
+// 颜色为spectrum个通道的值，应与render的图像的通道数一致
+template <typename T>
+struct DisplayList {
+    enum ShapeType { POLYGON, RING, SMOOTH_LINE };
+    struct Shape {
+        ShapeType type;
+        int first, count;           // 多边形的顶点为pts[first]...pts[first + count - 1]，抗锯齿线段的两端点同样存放
+        point c;                    // 圆环的圆心、半径与宽度，抗锯齿线段只用到宽度
+        double r, width;
+        int color;                  // 颜色为colors[color]...colors[color + spectrum - 1]
+        double x0, y0, x1, y1;      // 包围盒
+    };
+
+    int spectrum;
+    vector<Shape> shapes;
+    vector<point> pts;
+    vector<T> colors;
+
+    DisplayList(int spectrum) : spectrum(spectrum) {}
+
+    void clear() {
+        shapes.clear();
+        pts.clear();
+        colors.clear();
+    }
+
+    void polygon(point const *P, int n, T const *color) {
+        Shape s;
+        s.type = POLYGON;
+        s.first = pts.size();
+        s.count = n;
+        s.x0 = s.x1 = P[0].x;
+        s.y0 = s.y1 = P[0].y;
+        for (int i = 0; i < n; i++) {
+            pts.push_back(P[i]);
+            s.x0 = std::min(s.x0, P[i].x); s.x1 = std::max(s.x1, P[i].x);
+            s.y0 = std::min(s.y0, P[i].y); s.y1 = std::max(s.y1, P[i].y);
+        }
+        add(s, color);
+    }
+
+    void line(point p1, point p2, double width, T const *color) {
+        point Q[4];
+        thickLineQuad(p1, p2, width, Q);
+        polygon(Q, 4, color);
+    }
+
+    void smoothLine(point p1, point p2, double width, T const *color) {
+        Shape s;
+        s.type = SMOOTH_LINE;
+        s.first = pts.size();
+        s.count = 2;
+        s.width = width;
+        pts.push_back(p1);
+        pts.push_back(p2);
+        double ext = width / 2 + 1;
+        s.x0 = std::min(p1.x, p2.x) - ext; s.x1 = std::max(p1.x, p2.x) + ext;
+        s.y0 = std::min(p1.y, p2.y) - ext; s.y1 = std::max(p1.y, p2.y) + ext;
+        add(s, color);
+    }
+
+    void ring(point c, double r, double width, T const *color) {
+        Shape s;
+        s.type = RING;
+        s.c = c;
+        s.r = r;
+        s.width = width;
+        double ro = r + width / 2;
+        s.x0 = c.x - ro; s.x1 = c.x + ro;
+        s.y0 = c.y - ro; s.y1 = c.y + ro;
+        add(s, color);
+    }
+
+    void render(CImg<T> &img, int tile = 64) const {
+        int tw = (img.width() + tile - 1) / tile, th = (img.height() + tile - 1) / tile;
+        vector< vector<int> > bins(tw * th);
+        for (int i = 0; i < (int)shapes.size(); i++) {
+            Shape const &s = shapes[i];
+            if (s.x1 < 0 || s.y1 < 0 || s.x0 > img.width() - 1 || s.y0 > img.height() - 1) continue;
+            int tx0 = std::max(0, (int)s.x0 / tile), tx1 = std::min(tw - 1, (int)s.x1 / tile),
+                ty0 = std::max(0, (int)s.y0 / tile), ty1 = std::min(th - 1, (int)s.y1 / tile);
+            for (int ty = ty0; ty <= ty1; ty++)
+                for (int tx = tx0; tx <= tx1; tx++) bins[ty * tw + tx].push_back(i);
+        }
+
+#ifdef cimg_use_openmp
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int b = 0; b < tw * th; b++) {
+            if (bins[b].empty()) continue;
+            int tx = b % tw, ty = b / tw;
+            ClipRect clip(tx * tile, ty * tile, std::min(img.width(), (tx + 1) * tile) - 1,
+                          std::min(img.height(), (ty + 1) * tile) - 1);
+            for (int k = 0; k < (int)bins[b].size(); k++) {
+                Shape const &s = shapes[bins[b][k]];
+                if (s.type == POLYGON) fillConvexPolygon(img, &pts[s.first], s.count, &colors[s.color], clip);
+                else if (s.type == SMOOTH_LINE) drawSmoothLine(img, pts[s.first], pts[s.first + 1], s.width, &colors[s.color], clip);
+                else drawRing(img, s.c, s.r, s.width, &colors[s.color], clip);
+            }
+        }
+    }
+
+private:
+    void add(Shape &s, T const *color) {
+        s.color = colors.size();
+        colors.insert(colors.end(), color, color + spectrum);
+        shapes.push_back(s);
+    }
+};
+
+// 确保p2、p3在矩形中是相对的两点，即p1为直角顶点，三点不构成直角时不调整顺序并返回false
+bool rectangleCorner(point &p1, point &p2, point &p3) {
     double d12 = dist(p1, p2), d13 = dist(p1, p3), d23 = dist(p2, p3);
-    cimg_forXY(img, x, y) {
-        point p0(x, y);
-        if (  (dist(p0, p1, p2) < bound / 2 && dist(p0, p1) + dist(p0, p2) < d12 + bound)
-           || (dist(p0, p1, p3) < bound / 2 && dist(p0, p1) + dist(p0, p3) < d13 + bound)
-           || (dist(p0, p2, p3) < bound / 2 && dist(p0, p2) + dist(p0, p3) < d23 + bound))
-            img(x, y) = 0;
+    if (fabs(d12 * d12 + d13 * d13 - d23 * d23) < EPS) return true;
+    if (fabs(d13 * d13 + d23 * d23 - d12 * d12) < EPS) {
+        std::swap(p1, p3);
+        return true;
+    }
+    if (fabs(d12 * d12 + d23 * d23 - d13 * d13) < EPS) {
+        std::swap(p1, p2);
+        return true;
     }
+    return false;
+}
+
+// 画出以p1为顶点、p1p2与p1p3为两边的平行四边形的边框
+// p4为p1的对角，四条边分别画出，超出clip的部分被截断
+template <typename T>
+void drawParallelogram(CImg<T>& img, point p1, point p2, point p3, double bound, T const *color, ClipRect const &clip) {
+    point p4(p2.x + p3.x - p1.x, p2.y + p3.y - p1.y);
+    drawThickLine(img, p1, p2, bound, color, clip);
+    drawThickLine(img, p1, p3, bound, color, clip);
+    drawThickLine(img, p4, p2, bound, color, clip);
+    drawThickLine(img, p4, p3, bound, color, clip);
+}
+
+// 画出由p1 p2 p3三点确定的矩形（平行四边形），若不是矩形会有提示，bound为边宽
+void drawrectangle(CImg<unsigned char>& img, point p1, point p2, point p3, unsigned int bound) {
+    if (!rectangleCorner(p1, p2, p3)) std::cout << "WARRANTY: Not a rectangle.\n";
+    std::vector<unsigned char> black(img.spectrum(), 0);
+    drawParallelogram(img, p1, p2, p3, bound, &black[0], ClipRect(img));
+}
+
+// 画出由p1 p2 p3三点确定的三角形，bound为边宽
+void drawreiangle(CImg<unsigned char>& img, point p1, point p2, point p3, unsigned int bound) {
+    unsigned char black = 0;
+    drawThickLine(img, p1, p2, bound, black);
+    drawThickLine(img, p1, p3, bound, black);
+    drawThickLine(img, p2, p3, bound, black);
 }
 
 // 画出以p1为原点，r为半径的圆，bound为边宽
 void drawcicle(CImg<float>& img, point p1, unsigned int r, unsigned int bound) {
-    cimg_forXY(img, x, y) {
-        point p0(x, y);
-        if (fabs(dist(p0, p1) - r) < bound / 2) img(x, y) = 255;
-    }
+    drawRing(img, p1, r, bound, 255.0f);
 }